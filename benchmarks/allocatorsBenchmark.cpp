@@ -0,0 +1,1461 @@
+/**
+ * @file allocatorsBenchmark.cpp
+ * @brief the allocator benchmarks, every result is one json object on its own line of stdout so the runs of two
+ * releases can be compared with any json tool.
+ *
+ * allocatorsBenchmark [--only name,...] [--threads max] [--scale factor] [--caches cpu|cid|thread]
+ *                     [--pages default|thp|2mb|1gb] [--stats]
+ *
+ * latency          alloc and free of each size class one after the other and in bursts of 1024, on one thread.
+ *                  sharedSlabs skips the fast cells and takes every cell from the slabs under the cache lock
+ * freeListScan     the slab free list search at 0/50/90/99% full(the size field), by words against byte by byte
+ * batch            sharedAllocBatch and sharedFreeBatch of 64 cells against 64 single calls
+ * aligned          64 byte allocations aligned to size
+ * threads          throughput of a window of random sizes at 1, 2, 4 ... max threads
+ * producerConsumer pairs of threads, one allocates and the other frees
+ * larson           threads replace random slots and give their slots to the next generation of threads
+ * xmalloc          producers allocate batches that any of the consumers frees
+ * cacheScratch     threads free a neighbour of the object of another thread and then write to their own objects
+ * threadtest       threads allocate and free many small objects at once
+ * threadSpawn      a thread that does one allocation, from create to join
+ * rss              the live bytes, rss and page heap bytes while random sizes grow and shrink
+ * tlb              dTLB load misses of random reads over a 256MiB block, run it once for each --pages mode
+ *
+ * --stats writes the pool stats to stderr as json when the benchmarks are done.
+ */
+
+#include "defaultTrace.h"
+
+#include "err.h"
+
+#include "allocators/sharedMemoryPool.h"
+#include "allocators/unsafeAllocator.h"
+#include "memoryUtils/allocatorsUtilFunctions.h"
+#include "os/sharedMemoryFile.h"
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_THREADS 256
+#define BENCH_BURST_SIZE 1024
+#define BENCH_BATCH_SIZE 64
+#define BENCH_THREADS_WINDOW 64
+#define BENCH_RING_SIZE 1024
+#define BENCH_LARSON_SLOTS 1000
+#define BENCH_LARSON_GENERATIONS 4
+#define BENCH_RSS_SLOTS 20000
+#define BENCH_TLB_BYTES (256ul << 20)
+
+// the slab page of the standalone unsafe allocator, the same size as in the pool so a cell finds its slab the same way
+#define BENCH_SLAB_ALIGNMENT (1ul << MIN_BUDDY_BLOCK_SIZE_EXPONENT)
+
+typedef err_t (*benchAllocFunction)(void **data, size_t size);
+typedef err_t (*benchFreeFunction)(void **data, size_t size);
+
+typedef struct
+{
+	const char *name;
+	THROWS benchAllocFunction alloc;
+	THROWS benchFreeFunction free;
+} benchAllocator;
+
+typedef struct
+{
+	const char *only;
+	size_t maxThreads;
+	double scale;
+	bool isStatsDumped;
+} benchConfig;
+
+static benchConfig config = {NULL, 0, 1.0, false};
+
+static slabCache unsafeCaches[SIZE_CLASSES_COUNT];
+static bool isUnsafeReady = false;
+
+static double getSeconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static uint64_t scaled(uint64_t count)
+{
+	uint64_t res = (uint64_t)(count * config.scale);
+
+	return res > 0 ? res : 1;
+}
+
+static uint64_t nextRandom(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static size_t randomSize(uint64_t *state, size_t min, size_t max)
+{
+	return min + nextRandom(state) % (max - min + 1);
+}
+
+static bool isSelected(const char *name)
+{
+	const char *start = config.only;
+	size_t length = strlen(name);
+
+	if (start == NULL)
+	{
+		return true;
+	}
+
+	while (start != NULL && *start != '\0')
+	{
+		if (strncmp(start, name, length) == 0 && (start[length] == ',' || start[length] == '\0'))
+		{
+			return true;
+		}
+
+		start = strchr(start, ',');
+		start = start != NULL ? start + 1 : NULL;
+	}
+
+	return false;
+}
+
+static void printResult(const char *benchmark, const char *allocator, size_t threads, size_t size, uint64_t ops,
+						double seconds)
+{
+	printf("{\"benchmark\":\"%s\",\"allocator\":\"%s\",\"threads\":%zu,\"size\":%zu,\"ops\":%lu,\"seconds\":%.6f,"
+		   "\"nsPerOp\":%.2f,\"mopsPerSecond\":%.3f}\n",
+		   benchmark, allocator, threads, size, ops, seconds, seconds * 1e9 / ops, ops / seconds / 1e6);
+	fflush(stdout);
+}
+
+THROWS static err_t sharedBenchAlloc(void **data, size_t size)
+{
+	*data = NULL;
+	return sharedAlloc(data, 1, size, 0, NULL);
+}
+
+THROWS static err_t sharedBenchFree(void **data, [[maybe_unused]] size_t size)
+{
+	return sharedDealloc(data, NULL);
+}
+
+THROWS static err_t sharedBenchFreeSized(void **data, size_t size)
+{
+	return sharedDeallocSized(data, size, NULL);
+}
+
+/**
+ * @brief a batch of one cell never uses the fast cells, it is the slow path of every shared allocation.
+ */
+THROWS static err_t sharedSlabsBenchAlloc(void **data, size_t size)
+{
+	return sharedAllocBatch(data, 1, size);
+}
+
+THROWS static err_t sharedSlabsBenchFree(void **data, [[maybe_unused]] size_t size)
+{
+	return sharedFreeBatch(data, 1);
+}
+
+THROWS static err_t libcBenchAlloc(void **data, size_t size)
+{
+	err_t err = NO_ERRORCODE;
+
+	*data = malloc(size);
+	QUITE_CHECK(*data != NULL);
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t libcBenchFree(void **data, [[maybe_unused]] size_t size)
+{
+	free(*data);
+	*data = NULL;
+	return NO_ERRORCODE;
+}
+
+/**
+ * @brief the slab caches without the pool around them, only from one thread and only until there slabs run out.
+ */
+THROWS static err_t initUnsafeCaches()
+{
+	err_t err = NO_ERRORCODE;
+	memoryAllocator allocator;
+	slab *s = NULL;
+	size_t slabCount = 0;
+
+	for (size_t j = 0; j < SIZE_CLASSES_COUNT && !isUnsafeReady; j++)
+	{
+		// enough for a burst and the cells that are still in the fast cells of nobody
+		slabCount = BENCH_BURST_SIZE / defaultSlabLayout::cellCount(allocationCachesSizes[j]) + 2;
+		for (size_t i = 0; i < slabCount; i++)
+		{
+			s = (slab *)aligned_alloc(BENCH_SLAB_ALIGNMENT, BENCH_SLAB_ALIGNMENT);
+			QUITE_CHECK(s != NULL);
+
+			if (i == 0)
+			{
+				QUITE_RETHROW(createUnsafeAllocator(&allocator, &unsafeCaches[j], s, allocationCachesSizes[j]));
+			}
+			else
+			{
+				QUITE_RETHROW(appendSlab(&unsafeCaches[j], s));
+			}
+		}
+	}
+
+	isUnsafeReady = true;
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t unsafeBenchAlloc(void **data, size_t size)
+{
+	*data = NULL;
+	return unsafeAlloc(data, 1, size, 0, &unsafeCaches[getSizeClass(size)]);
+}
+
+THROWS static err_t unsafeBenchFree(void **data, [[maybe_unused]] size_t size)
+{
+	return unsafeDealloc(data, (void *)((uintptr_t)*data & ~(BENCH_SLAB_ALIGNMENT - 1)));
+}
+
+static const benchAllocator sharedBenchAllocator = {"shared", sharedBenchAlloc, sharedBenchFree};
+static const benchAllocator sharedSizedBenchAllocator = {"sharedSized", sharedBenchAlloc, sharedBenchFreeSized};
+static const benchAllocator sharedSlabsBenchAllocator = {"sharedSlabs", sharedSlabsBenchAlloc, sharedSlabsBenchFree};
+static const benchAllocator libcBenchAllocator = {"libc", libcBenchAlloc, libcBenchFree};
+static const benchAllocator unsafeBenchAllocator = {"unsafe", unsafeBenchAlloc, unsafeBenchFree};
+
+// the allocators that can be used from many threads
+static const benchAllocator *const threadSafeAllocators[] = {&sharedBenchAllocator, &libcBenchAllocator};
+
+/**
+ * @brief what a thread of a multithreaded benchmark gets, every worker uses the fields it needs.
+ */
+/**
+ * @brief where the threads of a run wait until all of them are ready, a run that could not create all of its threads
+ * cancels the ones it did.
+ */
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	size_t readyCount;
+	bool isStarted;
+	bool isCanceled;
+} benchStart;
+
+typedef struct benchThread
+{
+	const benchAllocator *allocator;
+	benchStart *start;
+	size_t index;
+	size_t threadCount;
+	uint64_t ops;
+	void **slots;
+	struct benchRing *ring;
+	err_t err;
+} benchThread;
+
+typedef void *(*benchThreadMain)(void *arg);
+
+/**
+ * @brief the first thing a thread of runThreads does, fails with ECANCELED if the run could not start all of its
+ * threads.
+ */
+THROWS static err_t waitForStart(benchStart *start)
+{
+	err_t err = NO_ERRORCODE;
+	bool isCanceled = false;
+
+	pthread_mutex_lock(&start->lock);
+	start->readyCount++;
+	pthread_cond_broadcast(&start->changed);
+	while (!start->isStarted && !start->isCanceled)
+	{
+		pthread_cond_wait(&start->changed, &start->lock);
+	}
+
+	isCanceled = start->isCanceled;
+	pthread_mutex_unlock(&start->lock);
+
+	CHECK_NOTRACE_ERRORCODE(!isCanceled, ECANCELED);
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief start count threads on main, they all wait in waitForStart so the time is only taken from when they are all
+ * ready to when the last one is done.
+ */
+THROWS static err_t runThreads(benchThread *threads, size_t count, benchThreadMain threadMain, double *seconds)
+{
+	err_t err = NO_ERRORCODE;
+	pthread_t ids[BENCH_MAX_THREADS];
+	benchStart start = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, false, false};
+	size_t startedCount = 0;
+	double startTime = 0;
+
+	QUITE_CHECK(count > 0 && count <= BENCH_MAX_THREADS);
+
+	for (; startedCount < count; startedCount++)
+	{
+		threads[startedCount].start = &start;
+		threads[startedCount].err = NO_ERRORCODE;
+		QUITE_CHECK(pthread_create(&ids[startedCount], NULL, threadMain, &threads[startedCount]) == 0);
+	}
+
+	pthread_mutex_lock(&start.lock);
+	while (start.readyCount < count)
+	{
+		pthread_cond_wait(&start.changed, &start.lock);
+	}
+
+	start.isStarted = true;
+	pthread_cond_broadcast(&start.changed);
+	pthread_mutex_unlock(&start.lock);
+	startTime = getSeconds();
+
+cleanup:
+	// a thread that could not be created is never ready, the ones that were created are told to go home
+	if (startedCount < count)
+	{
+		fprintf(stderr, "only %zu of %zu threads started\n", startedCount, count);
+		pthread_mutex_lock(&start.lock);
+		start.isCanceled = true;
+		pthread_cond_broadcast(&start.changed);
+		pthread_mutex_unlock(&start.lock);
+	}
+
+	for (size_t i = 0; i < startedCount; i++)
+	{
+		pthread_join(ids[i], NULL);
+		if (err.errorCode == 0)
+		{
+			err = threads[i].err;
+		}
+	}
+
+	*seconds = getSeconds() - startTime;
+
+	return err;
+}
+
+THROWS static err_t benchLatency()
+{
+	err_t err = NO_ERRORCODE;
+	const benchAllocator *allocators[] = {&sharedBenchAllocator, &sharedSizedBenchAllocator,
+										  &sharedSlabsBenchAllocator, &libcBenchAllocator, &unsafeBenchAllocator};
+	void *burst[BENCH_BURST_SIZE] = {NULL};
+	void *data = NULL;
+	uint64_t ops = 0;
+	double start = 0;
+
+	QUITE_RETHROW(initUnsafeCaches());
+
+	for (size_t j = 0; j < SIZE_CLASSES_COUNT; j++)
+	{
+		for (const benchAllocator *allocator : allocators)
+		{
+			// the same cell over and over, this is the fast path
+			ops = scaled(2000000);
+			start = getSeconds();
+			for (uint64_t i = 0; i < ops; i++)
+			{
+				QUITE_RETHROW(allocator->alloc(&data, allocationCachesSizes[j]));
+				QUITE_RETHROW(allocator->free(&data, allocationCachesSizes[j]));
+			}
+
+			printResult("latency", allocator->name, 1, allocationCachesSizes[j], ops, getSeconds() - start);
+
+			// more cells then the fast cells hold, so they come from the slabs
+			ops = scaled(2000);
+			start = getSeconds();
+			for (uint64_t i = 0; i < ops; i++)
+			{
+				for (size_t k = 0; k < BENCH_BURST_SIZE; k++)
+				{
+					QUITE_RETHROW(allocator->alloc(&burst[k], allocationCachesSizes[j]));
+				}
+
+				for (size_t k = 0; k < BENCH_BURST_SIZE; k++)
+				{
+					QUITE_RETHROW(allocator->free(&burst[k], allocationCachesSizes[j]));
+				}
+			}
+
+			printResult("latencyBurst", allocator->name, 1, allocationCachesSizes[j], ops * BENCH_BURST_SIZE,
+						getSeconds() - start);
+		}
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t benchBatch()
+{
+	err_t err = NO_ERRORCODE;
+	void *cells[BENCH_BATCH_SIZE] = {NULL};
+	uint64_t ops = scaled(200000);
+	double start = getSeconds();
+
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		QUITE_RETHROW(sharedAllocBatch(cells, BENCH_BATCH_SIZE, 64));
+		QUITE_RETHROW(sharedFreeBatch(cells, BENCH_BATCH_SIZE));
+	}
+
+	printResult("batch", "sharedBatch", 1, 64, ops * BENCH_BATCH_SIZE, getSeconds() - start);
+
+	start = getSeconds();
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		for (size_t k = 0; k < BENCH_BATCH_SIZE; k++)
+		{
+			QUITE_RETHROW(sharedBenchAlloc(&cells[k], 64));
+		}
+
+		for (size_t k = 0; k < BENCH_BATCH_SIZE; k++)
+		{
+			QUITE_RETHROW(sharedBenchFree(&cells[k], 64));
+		}
+	}
+
+	printResult("batch", "shared", 1, 64, ops * BENCH_BATCH_SIZE, getSeconds() - start);
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t benchAligned()
+{
+	err_t err = NO_ERRORCODE;
+	const size_t alignments[] = {64, 256, 4096, 65536};
+	void *data = NULL;
+	uint64_t ops = 0;
+	double start = 0;
+
+	for (size_t alignment : alignments)
+	{
+		ops = scaled(alignment > 4096 ? 20000 : 1000000);
+
+		start = getSeconds();
+		for (uint64_t i = 0; i < ops; i++)
+		{
+			data = NULL;
+			QUITE_RETHROW(sharedAlignedAlloc(&data, 1, 64, alignment, 0, NULL));
+			QUITE_RETHROW(sharedDealloc(&data, NULL));
+		}
+
+		printResult("aligned", "shared", 1, alignment, ops, getSeconds() - start);
+
+		start = getSeconds();
+		for (uint64_t i = 0; i < ops; i++)
+		{
+			QUITE_CHECK(posix_memalign(&data, alignment, 64) == 0);
+			free(data);
+		}
+
+		printResult("aligned", "libc", 1, alignment, ops, getSeconds() - start);
+	}
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief the byte by byte then bit by bit free list search unsafeAlloc had before it skipped full words.
+ */
+static __attribute__((noinline)) int baselineFindFreeCell(const uint8_t *freeList, size_t freeListSize)
+{
+	for (size_t i = 0; i < freeListSize; i++)
+	{
+		if (freeList[i] == UINT8_MAX)
+		{
+			continue;
+		}
+
+		for (int j = 0; j < 8; j++)
+		{
+			if ((freeList[i] & (1 << j)) == 0)
+			{
+				return i * 8 + j;
+			}
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * @brief search the free list of a slab of the smallest class(the longest free list) that is filled from its start,
+ * the way a slab fills up, with the search unsafeAlloc uses and with the old one. both start at the first byte, the
+ * hint unsafeAlloc keeps would skip the full part.
+ */
+THROWS static err_t benchFreeListScan()
+{
+	err_t err = NO_ERRORCODE;
+	const size_t fillPercents[] = {0, 50, 90, 99};
+	const size_t cellSize = allocationCachesSizes[0];
+	const size_t cellCount = defaultSlabLayout::cellCount(cellSize);
+	const size_t freeListSize = defaultSlabLayout::freeListSize(cellSize);
+	uint8_t *freeList = NULL;
+	uint64_t ops = scaled(2000000);
+	volatile int freeCell = 0;
+	double start = 0;
+
+	freeList = (uint8_t *)calloc(freeListSize, 1);
+	QUITE_CHECK(freeList != NULL);
+
+	for (size_t fillPercent : fillPercents)
+	{
+		// the bits after the last cell are always set, like in a real slab
+		memset(freeList, 0, freeListSize);
+		for (size_t i = 0; i < freeListSize * 8; i++)
+		{
+			if (i < cellCount * fillPercent / 100 || i >= cellCount)
+			{
+				freeList[i / 8] |= 1 << (i % 8);
+			}
+		}
+
+		QUITE_CHECK(unsafeFindFreeCell(freeList, freeListSize, 0) == baselineFindFreeCell(freeList, freeListSize));
+
+		start = getSeconds();
+		for (uint64_t i = 0; i < ops; i++)
+		{
+			freeCell = unsafeFindFreeCell(freeList, freeListSize, 0);
+		}
+
+		printResult("freeListScan", "words", 1, fillPercent, ops, getSeconds() - start);
+
+		start = getSeconds();
+		for (uint64_t i = 0; i < ops; i++)
+		{
+			freeCell = baselineFindFreeCell(freeList, freeListSize);
+		}
+
+		printResult("freeListScan", "bytes", 1, fillPercent, ops, getSeconds() - start);
+	}
+
+	(void)freeCell;
+
+cleanup:
+	free(freeList);
+	return err;
+}
+
+/**
+ * @brief keep a window of live objects and replace the oldest one each step.
+ */
+static void *threadsMain(void *arg)
+{
+	benchThread *thread = (benchThread *)arg;
+	err_t err = NO_ERRORCODE;
+	void *window[BENCH_THREADS_WINDOW] = {NULL};
+	size_t sizes[BENCH_THREADS_WINDOW] = {0};
+	uint64_t random = thread->index + 1;
+	size_t slot = 0;
+
+	QUITE_RETHROW(waitForStart(thread->start));
+
+	for (uint64_t i = 0; i < thread->ops; i++)
+	{
+		slot = i % BENCH_THREADS_WINDOW;
+		if (window[slot] != NULL)
+		{
+			QUITE_RETHROW(thread->allocator->free(&window[slot], sizes[slot]));
+		}
+
+		sizes[slot] = randomSize(&random, 16, 1024);
+		QUITE_RETHROW(thread->allocator->alloc(&window[slot], sizes[slot]));
+	}
+
+cleanup:
+	for (size_t i = 0; i < BENCH_THREADS_WINDOW; i++)
+	{
+		if (window[i] != NULL)
+		{
+			REWARN(thread->allocator->free(&window[i], sizes[i]));
+		}
+	}
+
+	thread->err = err;
+	return NULL;
+}
+
+/**
+ * @brief a single producer single consumer queue of pointers between two threads.
+ */
+typedef struct benchRing
+{
+	void *slots[BENCH_RING_SIZE];
+	uint64_t head;
+	uint64_t tail;
+} benchRing;
+
+static void ringPush(benchRing *ring, void *data)
+{
+	while (atomic_load((_Atomic uint64_t *)&ring->tail) - atomic_load((_Atomic uint64_t *)&ring->head) ==
+		   BENCH_RING_SIZE)
+	{
+		sched_yield();
+	}
+
+	ring->slots[ring->tail % BENCH_RING_SIZE] = data;
+	atomic_store((_Atomic uint64_t *)&ring->tail, ring->tail + 1);
+}
+
+static void *ringPop(benchRing *ring)
+{
+	void *data = NULL;
+
+	while (atomic_load((_Atomic uint64_t *)&ring->head) == atomic_load((_Atomic uint64_t *)&ring->tail))
+	{
+		sched_yield();
+	}
+
+	data = ring->slots[ring->head % BENCH_RING_SIZE];
+	atomic_store((_Atomic uint64_t *)&ring->head, ring->head + 1);
+	return data;
+}
+
+/**
+ * @brief the even threads allocate and the odd ones free what the thread before them allocated.
+ */
+static void *producerConsumerMain(void *arg)
+{
+	benchThread *thread = (benchThread *)arg;
+	err_t err = NO_ERRORCODE;
+	void *data = NULL;
+
+	QUITE_RETHROW(waitForStart(thread->start));
+
+	for (uint64_t i = 0; i < thread->ops; i++)
+	{
+		if (thread->index % 2 == 0)
+		{
+			QUITE_RETHROW(thread->allocator->alloc(&data, 64));
+			ringPush(thread->ring, data);
+		}
+		else
+		{
+			data = ringPop(thread->ring);
+
+			// a NULL from a producer that failed, so we don't wait for cells that will never come
+			QUITE_CHECK(data != NULL);
+			QUITE_RETHROW(thread->allocator->free(&data, 64));
+		}
+	}
+
+cleanup:
+	if (err.errorCode != 0 && thread->index % 2 == 0)
+	{
+		ringPush(thread->ring, NULL);
+	}
+
+	thread->err = err;
+	return NULL;
+}
+
+/**
+ * @brief one generation of larson, replace random slots of the array this thread was given.
+ */
+static void *larsonMain(void *arg)
+{
+	benchThread *thread = (benchThread *)arg;
+	err_t err = NO_ERRORCODE;
+	uint64_t random = thread->index * 7919 + 1;
+	size_t slot = 0;
+
+	QUITE_RETHROW(waitForStart(thread->start));
+
+	for (uint64_t i = 0; i < thread->ops; i++)
+	{
+		slot = nextRandom(&random) % BENCH_LARSON_SLOTS;
+		if (thread->slots[slot] != NULL)
+		{
+			QUITE_RETHROW(thread->allocator->free(&thread->slots[slot], 0));
+		}
+
+		QUITE_RETHROW(thread->allocator->alloc(&thread->slots[slot], randomSize(&random, 16, 512)));
+	}
+
+cleanup:
+	thread->err = err;
+	return NULL;
+}
+
+/**
+ * @brief the batches of xmalloc, the producers push full batches and the consumers pop them.
+ */
+typedef struct xmallocBatch
+{
+	struct xmallocBatch *next;
+	void *cells[BENCH_BATCH_SIZE];
+} xmallocBatch;
+
+static pthread_mutex_t xmallocLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t xmallocReady = PTHREAD_COND_INITIALIZER;
+static xmallocBatch *xmallocBatches = NULL;
+
+// the producers that are still running, a consumer stops waiting once they are all gone even if one of them failed
+static size_t xmallocProducersLeft = 0;
+
+static void *xmallocMain(void *arg)
+{
+	benchThread *thread = (benchThread *)arg;
+	err_t err = NO_ERRORCODE;
+	xmallocBatch *batch = NULL;
+	uint64_t random = thread->index + 1;
+
+	QUITE_RETHROW(waitForStart(thread->start));
+
+	for (uint64_t i = 0; i < thread->ops / BENCH_BATCH_SIZE; i++)
+	{
+		if (thread->index % 2 == 0)
+		{
+			QUITE_RETHROW(thread->allocator->alloc((void **)&batch, sizeof(xmallocBatch)));
+			for (size_t k = 0; k < BENCH_BATCH_SIZE; k++)
+			{
+				QUITE_RETHROW(thread->allocator->alloc(&batch->cells[k], randomSize(&random, 16, 256)));
+			}
+
+			pthread_mutex_lock(&xmallocLock);
+			batch->next = xmallocBatches;
+			xmallocBatches = batch;
+			pthread_cond_signal(&xmallocReady);
+			pthread_mutex_unlock(&xmallocLock);
+			batch = NULL;
+		}
+		else
+		{
+			pthread_mutex_lock(&xmallocLock);
+			while (xmallocBatches == NULL && xmallocProducersLeft > 0)
+			{
+				pthread_cond_wait(&xmallocReady, &xmallocLock);
+			}
+
+			batch = xmallocBatches;
+			if (batch != NULL)
+			{
+				xmallocBatches = batch->next;
+			}
+
+			pthread_mutex_unlock(&xmallocLock);
+
+			// the producers stopped early, the one that failed has the error
+			if (batch == NULL)
+			{
+				goto cleanup;
+			}
+
+			for (size_t k = 0; k < BENCH_BATCH_SIZE; k++)
+			{
+				QUITE_RETHROW(thread->allocator->free(&batch->cells[k], 0));
+			}
+
+			QUITE_RETHROW(thread->allocator->free((void **)&batch, sizeof(xmallocBatch)));
+		}
+	}
+
+cleanup:
+	if (thread->index % 2 == 0)
+	{
+		pthread_mutex_lock(&xmallocLock);
+		xmallocProducersLeft--;
+		pthread_cond_broadcast(&xmallocReady);
+		pthread_mutex_unlock(&xmallocLock);
+	}
+
+	thread->err = err;
+	return NULL;
+}
+
+/**
+ * @brief free the object main gave us, it is next to the objects of the other threads, and then allocate and write
+ * our own objects. an allocator that hands out the freed cell to another core makes the threads share a cache line.
+ */
+static void *cacheScratchMain(void *arg)
+{
+	benchThread *thread = (benchThread *)arg;
+	err_t err = NO_ERRORCODE;
+	void *data = NULL;
+
+	QUITE_RETHROW(waitForStart(thread->start));
+
+	QUITE_RETHROW(thread->allocator->free(&thread->slots[thread->index], 8));
+	for (uint64_t i = 0; i < thread->ops; i++)
+	{
+		QUITE_RETHROW(thread->allocator->alloc(&data, 8));
+		for (size_t k = 0; k < 50; k++)
+		{
+			((volatile uint8_t *)data)[k % 8] = ((volatile uint8_t *)data)[k % 8] + 1;
+		}
+
+		QUITE_RETHROW(thread->allocator->free(&data, 8));
+	}
+
+cleanup:
+	thread->err = err;
+	return NULL;
+}
+
+static void *threadtestMain(void *arg)
+{
+	benchThread *thread = (benchThread *)arg;
+	err_t err = NO_ERRORCODE;
+	void **objects = NULL;
+	size_t objectCount = 100000 / thread->threadCount;
+
+	QUITE_RETHROW(waitForStart(thread->start));
+
+	objects = (void **)calloc(objectCount, sizeof(void *));
+	QUITE_CHECK(objects != NULL);
+
+	for (uint64_t round = 0; round < thread->ops / objectCount; round++)
+	{
+		for (size_t k = 0; k < objectCount; k++)
+		{
+			QUITE_RETHROW(thread->allocator->alloc(&objects[k], 8));
+		}
+
+		for (size_t k = 0; k < objectCount; k++)
+		{
+			QUITE_RETHROW(thread->allocator->free(&objects[k], 8));
+		}
+	}
+
+cleanup:
+	free(objects);
+	thread->err = err;
+	return NULL;
+}
+
+/**
+ * @brief 1, 2, 4 ... and max threads.
+ */
+static size_t getNextThreadCount(size_t threadCount)
+{
+	if (threadCount == config.maxThreads)
+	{
+		return 0;
+	}
+
+	return threadCount * 2 < config.maxThreads ? threadCount * 2 : config.maxThreads;
+}
+
+THROWS static err_t benchThreads()
+{
+	err_t err = NO_ERRORCODE;
+	benchThread threads[BENCH_MAX_THREADS];
+	double seconds = 0;
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		for (size_t count = 1; count != 0; count = getNextThreadCount(count))
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				threads[i] = {allocator, NULL, i, count, scaled(1000000), NULL, NULL, NO_ERRORCODE};
+			}
+
+			QUITE_RETHROW(runThreads(threads, count, threadsMain, &seconds));
+			printResult("threads", allocator->name, count, 0, scaled(1000000) * count, seconds);
+		}
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t benchProducerConsumer()
+{
+	err_t err = NO_ERRORCODE;
+	benchThread threads[BENCH_MAX_THREADS];
+	benchRing *rings = NULL;
+	size_t count = config.maxThreads >= 2 ? config.maxThreads & ~1ul : 2;
+	double seconds = 0;
+
+	rings = (benchRing *)calloc(count / 2, sizeof(benchRing));
+	QUITE_CHECK(rings != NULL);
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		bzero(rings, count / 2 * sizeof(benchRing));
+		for (size_t i = 0; i < count; i++)
+		{
+			threads[i] = {allocator, NULL, i, count, scaled(1000000), NULL, &rings[i / 2], NO_ERRORCODE};
+		}
+
+		QUITE_RETHROW(runThreads(threads, count, producerConsumerMain, &seconds));
+		printResult("producerConsumer", allocator->name, count, 64, scaled(1000000) * (count / 2), seconds);
+	}
+
+cleanup:
+	free(rings);
+	return err;
+}
+
+THROWS static err_t benchLarson()
+{
+	err_t err = NO_ERRORCODE;
+	benchThread threads[BENCH_MAX_THREADS];
+	void **slots = NULL;
+	size_t count = config.maxThreads;
+	double seconds = 0;
+	double totalSeconds = 0;
+
+	slots = (void **)calloc(count * BENCH_LARSON_SLOTS, sizeof(void *));
+	QUITE_CHECK(slots != NULL);
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		totalSeconds = 0;
+
+		// every generation is new threads and takes over the slots of the thread after it, so most frees are of
+		// cells another thread allocated
+		for (size_t generation = 0; generation < BENCH_LARSON_GENERATIONS; generation++)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				threads[i] = {allocator,
+							  NULL,
+							  i,
+							  count,
+							  scaled(200000),
+							  &slots[((i + generation) % count) * BENCH_LARSON_SLOTS],
+							  NULL,
+							  NO_ERRORCODE};
+			}
+
+			QUITE_RETHROW(runThreads(threads, count, larsonMain, &seconds));
+			totalSeconds += seconds;
+		}
+
+		printResult("larson", allocator->name, count, 0, scaled(200000) * count * BENCH_LARSON_GENERATIONS,
+					totalSeconds);
+
+		for (size_t i = 0; i < count * BENCH_LARSON_SLOTS; i++)
+		{
+			if (slots[i] != NULL)
+			{
+				QUITE_RETHROW(allocator->free(&slots[i], 0));
+			}
+		}
+	}
+
+cleanup:
+	free(slots);
+	return err;
+}
+
+THROWS static err_t benchXmalloc()
+{
+	err_t err = NO_ERRORCODE;
+	benchThread threads[BENCH_MAX_THREADS];
+	size_t count = config.maxThreads >= 2 ? config.maxThreads & ~1ul : 2;
+	uint64_t ops = scaled(1000000) / BENCH_BATCH_SIZE * BENCH_BATCH_SIZE;
+	double seconds = 0;
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			threads[i] = {allocator, NULL, i, count, ops, NULL, NULL, NO_ERRORCODE};
+		}
+
+		xmallocProducersLeft = count / 2;
+		QUITE_RETHROW(runThreads(threads, count, xmallocMain, &seconds));
+		printResult("xmalloc", allocator->name, count, 0, ops * (count / 2), seconds);
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t benchCacheScratch()
+{
+	err_t err = NO_ERRORCODE;
+	benchThread threads[BENCH_MAX_THREADS];
+	void *objects[BENCH_MAX_THREADS] = {NULL};
+	size_t count = config.maxThreads;
+	double seconds = 0;
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		// one after the other from the same thread, so they are next to each other
+		for (size_t i = 0; i < count; i++)
+		{
+			QUITE_RETHROW(allocator->alloc(&objects[i], 8));
+			threads[i] = {allocator, NULL, i, count, scaled(1000000), objects, NULL, NO_ERRORCODE};
+		}
+
+		QUITE_RETHROW(runThreads(threads, count, cacheScratchMain, &seconds));
+		printResult("cacheScratch", allocator->name, count, 8, scaled(1000000) * count, seconds);
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t benchThreadtest()
+{
+	err_t err = NO_ERRORCODE;
+	benchThread threads[BENCH_MAX_THREADS];
+	size_t count = config.maxThreads;
+	uint64_t ops = scaled(5000000) / count;
+	double seconds = 0;
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			threads[i] = {allocator, NULL, i, count, ops, NULL, NULL, NO_ERRORCODE};
+		}
+
+		QUITE_RETHROW(runThreads(threads, count, threadtestMain, &seconds));
+		printResult("threadtest", allocator->name, count, 8, ops / (100000 / count) * (100000 / count) * count,
+					seconds);
+	}
+
+cleanup:
+	return err;
+}
+
+static void *threadSpawnMain(void *arg)
+{
+	benchThread *thread = (benchThread *)arg;
+	err_t err = NO_ERRORCODE;
+	void *data = NULL;
+
+	QUITE_RETHROW(thread->allocator->alloc(&data, 64));
+	QUITE_RETHROW(thread->allocator->free(&data, 64));
+
+cleanup:
+	thread->err = err;
+	return NULL;
+}
+
+/**
+ * @brief the first allocation of a thread registers rseq or takes a thread slot, this is what that costs.
+ */
+THROWS static err_t benchThreadSpawn()
+{
+	err_t err = NO_ERRORCODE;
+	benchThread thread;
+	pthread_t id;
+	uint64_t ops = scaled(5000);
+	double start = 0;
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		thread = {allocator, NULL, 0, 1, 1, NULL, NULL, NO_ERRORCODE};
+
+		start = getSeconds();
+		for (uint64_t i = 0; i < ops; i++)
+		{
+			QUITE_CHECK(pthread_create(&id, NULL, threadSpawnMain, &thread) == 0);
+			pthread_join(id, NULL);
+			QUITE_RETHROW(thread.err);
+		}
+
+		printResult("threadSpawn", allocator->name, 1, 64, ops, getSeconds() - start);
+	}
+
+cleanup:
+	return err;
+}
+
+static size_t getRssBytes()
+{
+	FILE *statm = fopen("/proc/self/statm", "r");
+	size_t pages = 0;
+	size_t residentPages = 0;
+
+	if (statm == NULL)
+	{
+		return 0;
+	}
+
+	if (fscanf(statm, "%zu %zu", &pages, &residentPages) != 2)
+	{
+		residentPages = 0;
+	}
+
+	fclose(statm);
+	return residentPages * sysconf(_SC_PAGESIZE);
+}
+
+THROWS static err_t printRssSample(const char *allocator, const char *phase, size_t step, size_t liveBytes,
+								   size_t startRss)
+{
+	err_t err = NO_ERRORCODE;
+	sharedMemoryStats stats;
+
+	QUITE_RETHROW(getSharedMemoryStats(&stats));
+
+	printf("{\"benchmark\":\"rss\",\"allocator\":\"%s\",\"phase\":\"%s\",\"step\":%zu,\"liveBytes\":%zu,"
+		   "\"rssBytes\":%zu,\"pageHeapBytes\":%lu,\"fileSize\":%lu}\n",
+		   allocator, phase, step, liveBytes, getRssBytes() - startRss, stats.pageHeapBytes, stats.fileSize);
+	fflush(stdout);
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief grow a set of random sizes(a few of them large blocks) and then free most of it in a random order, the rss
+ * is from the start of the run so the two allocators can be compared even though they share the process.
+ */
+THROWS static err_t benchRss()
+{
+	err_t err = NO_ERRORCODE;
+	void **slots = NULL;
+	size_t *sizes = NULL;
+	size_t liveBytes = 0;
+	size_t startRss = 0;
+	size_t slot = 0;
+	size_t releasedBytes = 0;
+	uint64_t random = 42;
+	uint64_t stepOps = scaled(BENCH_RSS_SLOTS);
+
+	slots = (void **)calloc(BENCH_RSS_SLOTS, sizeof(void *));
+	sizes = (size_t *)calloc(BENCH_RSS_SLOTS, sizeof(size_t));
+	QUITE_CHECK(slots != NULL && sizes != NULL);
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		startRss = getRssBytes();
+		liveBytes = 0;
+
+		for (size_t step = 0; step < 20; step++)
+		{
+			// the first half mostly allocates and the second half mostly frees
+			for (uint64_t i = 0; i < stepOps; i++)
+			{
+				slot = nextRandom(&random) % BENCH_RSS_SLOTS;
+				if (slots[slot] != NULL && (step >= 10 || nextRandom(&random) % 4 == 0))
+				{
+					liveBytes -= sizes[slot];
+					QUITE_RETHROW(allocator->free(&slots[slot], sizes[slot]));
+				}
+				else if (slots[slot] == NULL && (step < 10 || nextRandom(&random) % 4 == 0))
+				{
+					sizes[slot] = nextRandom(&random) % 64 == 0 ? randomSize(&random, 16384, 1 << 20)
+																: randomSize(&random, 16, 4096);
+					QUITE_RETHROW(allocator->alloc(&slots[slot], sizes[slot]));
+					memset(slots[slot], 1, sizes[slot]);
+					liveBytes += sizes[slot];
+				}
+			}
+
+			QUITE_RETHROW(printRssSample(allocator->name, step < 10 ? "grow" : "shrink", step, liveBytes, startRss));
+		}
+
+		if (allocator == &sharedBenchAllocator)
+		{
+			QUITE_RETHROW(sharedMemoryTrim(&releasedBytes));
+			QUITE_RETHROW(printRssSample(allocator->name, "trim", 20, liveBytes, startRss));
+		}
+
+		for (size_t i = 0; i < BENCH_RSS_SLOTS; i++)
+		{
+			if (slots[i] != NULL)
+			{
+				QUITE_RETHROW(allocator->free(&slots[i], sizes[i]));
+			}
+		}
+	}
+
+cleanup:
+	free(slots);
+	free(sizes);
+	return err;
+}
+
+THROWS static err_t parseArguments(int argc, char **argv)
+{
+	err_t err = NO_ERRORCODE;
+	const char *value = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--stats") == 0)
+		{
+			config.isStatsDumped = true;
+			continue;
+		}
+
+		CHECK_TRACE(i + 1 < argc, "%s needs a value", argv[i]);
+		value = argv[++i];
+
+		if (strcmp(argv[i - 1], "--only") == 0)
+		{
+			config.only = value;
+		}
+		else if (strcmp(argv[i - 1], "--threads") == 0)
+		{
+			config.maxThreads = strtoul(value, NULL, 10);
+			CHECK_TRACE(config.maxThreads > 0 && config.maxThreads <= BENCH_MAX_THREADS, "bad thread count %s",
+						value);
+		}
+		else if (strcmp(argv[i - 1], "--scale") == 0)
+		{
+			config.scale = strtod(value, NULL);
+			CHECK_TRACE(config.scale > 0, "bad scale %s", value);
+		}
+		else if (strcmp(argv[i - 1], "--caches") == 0)
+		{
+			CHECK_TRACE(strcmp(value, "cpu") == 0 || strcmp(value, "cid") == 0 || strcmp(value, "thread") == 0,
+						"bad cache index %s", value);
+			QUITE_RETHROW(setSharedMemoryCacheIndex(strcmp(value, "cpu") == 0   ? SHARED_MEMORY_CACHE_PER_CPU
+													: strcmp(value, "cid") == 0 ? SHARED_MEMORY_CACHE_PER_CID
+																				: SHARED_MEMORY_CACHE_PER_THREAD));
+		}
+		else if (strcmp(argv[i - 1], "--pages") == 0)
+		{
+			CHECK_TRACE(strcmp(value, "default") == 0 || strcmp(value, "thp") == 0 || strcmp(value, "2mb") == 0 ||
+							strcmp(value, "1gb") == 0,
+						"bad page mode %s", value);
+			QUITE_RETHROW(setSharedMemoryFilePageMode(strcmp(value, "thp") == 0   ? SHARED_MEMORY_PAGES_TRANSPARENT_HUGE
+													  : strcmp(value, "2mb") == 0 ? SHARED_MEMORY_PAGES_HUGE_2MB
+													  : strcmp(value, "1gb") == 0 ? SHARED_MEMORY_PAGES_HUGE_1GB
+																				  : SHARED_MEMORY_PAGES_DEFAULT));
+		}
+		else
+		{
+			CHECK_TRACE(false, "unknown argument %s", argv[i - 1]);
+		}
+	}
+
+	if (config.maxThreads == 0)
+	{
+		config.maxThreads = sysconf(_SC_NPROCESSORS_ONLN) > BENCH_MAX_THREADS ? BENCH_MAX_THREADS
+																			   : sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief the first line says what the run was, so results of different machines or configurations are not mixed.
+ */
+THROWS static err_t printMeta()
+{
+	err_t err = NO_ERRORCODE;
+	const char *const cacheIndexNames[] = {"cpu", "cid", "thread"};
+	const char *const pageModeNames[] = {"default", "thp", "2mb", "1gb"};
+	sharedMemoryCacheIndex index = SHARED_MEMORY_CACHE_PER_CPU;
+	sharedMemoryPageMode pageMode = SHARED_MEMORY_PAGES_DEFAULT;
+	size_t pageSize = 0;
+
+	QUITE_RETHROW(getSharedMemoryCacheIndex(&index));
+	QUITE_RETHROW(getSharedMemoryFilePageMode(&pageMode, &pageSize));
+
+	printf("{\"benchmark\":\"meta\",\"caches\":\"%s\",\"pages\":\"%s\",\"pageSize\":%zu,\"cpus\":%ld,"
+		   "\"maxThreads\":%zu,\"scale\":%.3f}\n",
+		   cacheIndexNames[index], pageModeNames[pageMode], pageSize, sysconf(_SC_NPROCESSORS_ONLN), config.maxThreads,
+		   config.scale);
+	fflush(stdout);
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief count the dTLB load misses of this thread in user space from now on, fd is -1 if the kernel or the cpu can't
+ * count them(no pmu in a vm, perf_event_paranoid above 2).
+ */
+static int openTlbMissCounter()
+{
+	struct perf_event_attr attr = {};
+	int fd = -1;
+
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd >= 0)
+	{
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	return fd;
+}
+
+/**
+ * @brief read one byte of every random cache line of a block that is already faulted in, so the time and the misses
+ * are the ones of the page walks and not of the page faults.
+ */
+THROWS static err_t benchTlb()
+{
+	err_t err = NO_ERRORCODE;
+	uint8_t *block = NULL;
+	uint64_t random = 42;
+	uint64_t ops = scaled(20000000);
+	uint64_t misses = 0;
+	uint64_t sum = 0;
+	volatile uint64_t sink = 0;
+	int counterFd = -1;
+	double start = 0;
+	double seconds = 0;
+
+	for (const benchAllocator *allocator : threadSafeAllocators)
+	{
+		QUITE_RETHROW(allocator->alloc((void **)&block, BENCH_TLB_BYTES));
+		memset(block, 1, BENCH_TLB_BYTES);
+
+		counterFd = openTlbMissCounter();
+		start = getSeconds();
+		for (uint64_t i = 0; i < ops; i++)
+		{
+			sum += block[(nextRandom(&random) % (BENCH_TLB_BYTES / 64)) * 64];
+		}
+
+		seconds = getSeconds() - start;
+		sink = sum;
+		if (counterFd >= 0)
+		{
+			ioctl(counterFd, PERF_EVENT_IOC_DISABLE, 0);
+			QUITE_CHECK(read(counterFd, &misses, sizeof(misses)) == sizeof(misses));
+			close(counterFd);
+			counterFd = -1;
+
+			printf("{\"benchmark\":\"tlb\",\"allocator\":\"%s\",\"size\":%lu,\"ops\":%lu,\"nsPerOp\":%.2f,"
+				   "\"dtlbLoadMisses\":%lu,\"missesPerOp\":%.4f}\n",
+				   allocator->name, BENCH_TLB_BYTES, ops, seconds * 1e9 / ops, misses, (double)misses / ops);
+		}
+		else
+		{
+			printf("{\"benchmark\":\"tlb\",\"allocator\":\"%s\",\"size\":%lu,\"ops\":%lu,\"nsPerOp\":%.2f,"
+				   "\"dtlbLoadMisses\":null,\"missesPerOp\":null}\n",
+				   allocator->name, BENCH_TLB_BYTES, ops, seconds * 1e9 / ops);
+		}
+
+		fflush(stdout);
+		QUITE_RETHROW(allocator->free((void **)&block, BENCH_TLB_BYTES));
+	}
+
+cleanup:
+	if (counterFd >= 0)
+	{
+		close(counterFd);
+	}
+
+	(void)sink;
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	err_t err = NO_ERRORCODE;
+	bool isPoolReady = false;
+
+	QUITE_RETHROW(parseArguments(argc, argv));
+	QUITE_RETHROW(initSharedMemory());
+	isPoolReady = true;
+	QUITE_RETHROW(printMeta());
+
+	if (isSelected("latency"))
+	{
+		QUITE_RETHROW(benchLatency());
+	}
+
+	if (isSelected("freeListScan"))
+	{
+		QUITE_RETHROW(benchFreeListScan());
+	}
+
+	if (isSelected("batch"))
+	{
+		QUITE_RETHROW(benchBatch());
+	}
+
+	if (isSelected("aligned"))
+	{
+		QUITE_RETHROW(benchAligned());
+	}
+
+	if (isSelected("threads"))
+	{
+		QUITE_RETHROW(benchThreads());
+	}
+
+	if (isSelected("producerConsumer"))
+	{
+		QUITE_RETHROW(benchProducerConsumer());
+	}
+
+	if (isSelected("larson"))
+	{
+		QUITE_RETHROW(benchLarson());
+	}
+
+	if (isSelected("xmalloc"))
+	{
+		QUITE_RETHROW(benchXmalloc());
+	}
+
+	if (isSelected("cacheScratch"))
+	{
+		QUITE_RETHROW(benchCacheScratch());
+	}
+
+	if (isSelected("threadtest"))
+	{
+		QUITE_RETHROW(benchThreadtest());
+	}
+
+	if (isSelected("threadSpawn"))
+	{
+		QUITE_RETHROW(benchThreadSpawn());
+	}
+
+	if (isSelected("rss"))
+	{
+		QUITE_RETHROW(benchRss());
+	}
+
+	if (isSelected("tlb"))
+	{
+		QUITE_RETHROW(benchTlb());
+	}
+
+	if (config.isStatsDumped)
+	{
+		QUITE_RETHROW(dumpSharedMemoryStats(STDERR_FILENO, SHARED_MEMORY_STATS_JSON));
+	}
+
+cleanup:
+	if (isPoolReady)
+	{
+		REWARN(closeSharedMemory());
+	}
+
+	return err.errorCode == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "types/err_t.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief a flat table from a page of the pool(the smallest buddy block) to what is on it, so finding out what a pointer
+ * is costs one indexed load and never reads memory that belongs to the user.
+ * @note thank you to tcmalloc for the idea.
+ *
+ * a slab is exactly one page so the page start is the slab start, a large block is recorded only on its first page.
+ * the owning core is not kept here, slabs move between cores through the transfer caches without the page heap so it
+ * is read from the slab header.
+ */
+typedef enum : uint8_t
+{
+	PAGEMAP_UNUSED,
+	PAGEMAP_SLAB,
+	PAGEMAP_LARGE_BLOCK,
+} pagemapKind;
+
+typedef struct alignas(4)
+{
+	pagemapKind kind;
+
+	// for PAGEMAP_SLAB
+	uint8_t sizeClass;
+
+	// for PAGEMAP_LARGE_BLOCK, the block is 2^blockExponent bytes
+	uint8_t blockExponent;
+
+	// for PAGEMAP_LARGE_BLOCK, only the first 2^liveExponent bytes can hold data, a realloc shrink gave the rest back
+	uint8_t liveExponent;
+} pagemapEntry;
+
+typedef struct
+{
+	pagemapEntry *entries;
+	uintptr_t base;
+	size_t pageExponent;
+	size_t pageCount;
+} pagemap;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	/**
+	 * @brief a table for 2^rangeExponent bytes from base in entries, pagemapGetTableSize bytes of zeroed memory that
+	 * the caller owns, the pool puts it in the shared memory so every process that maps the pool sees the same table.
+	 */
+	THROWS err_t initPagemap(pagemap *map, pagemapEntry *entries, void *base, size_t rangeExponent,
+							 size_t pageExponent);
+	err_t closePagemap(pagemap *map);
+
+	THROWS err_t pagemapSetSlab(pagemap *map, void *slabStart, uint8_t sizeClass);
+	THROWS err_t pagemapSetLargeBlock(pagemap *map, void *block, uint8_t blockExponent);
+
+	/**
+	 * @brief mark only the first 2^liveExponent bytes of a large block as used, at most its whole block.
+	 */
+	THROWS err_t pagemapSetLargeBlockLiveSize(pagemap *map, void *block, uint8_t liveExponent);
+	THROWS err_t pagemapClear(pagemap *map, void *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline size_t pagemapGetTableSize(size_t rangeExponent, size_t pageExponent)
+{
+	return (1ul << (rangeExponent - pageExponent)) * sizeof(pagemapEntry);
+}
+
+/**
+ * @return the entry of the page that holds addr, NULL if addr is not in the pool
+ */
+static inline const pagemapEntry *pagemapGet(const pagemap *map, const void *addr)
+{
+	size_t page = ((uintptr_t)addr - map->base) >> map->pageExponent;
+
+	// an address under base wraps around to a huge page number
+	return page < map->pageCount ? &map->entries[page] : NULL;
+}
+
+static inline void *pagemapGetPageStart(const pagemap *map, const void *addr)
+{
+	return (void *)((uintptr_t)addr & ~((1ul << map->pageExponent) - 1));
+}
@@ -3,19 +3,298 @@
 #include <cstddef>
 #include <unistd.h>
 
+#include "os/numa.h"
 #include "types/memoryAllocator.h"
+
+#ifndef SHARED_MEMORY_REFILL_LOW_WATERMARK
+#define SHARED_MEMORY_REFILL_LOW_WATERMARK 1
+#endif
+
+#ifndef SHARED_MEMORY_REFILL_HIGH_WATERMARK
+#define SHARED_MEMORY_REFILL_HIGH_WATERMARK 2
+#endif
+
+#ifndef SHARED_MEMORY_REFILL_INTERVAL_US
+#define SHARED_MEMORY_REFILL_INTERVAL_US 1000
+#endif
+
+// a cell that shrinks this many size classes or more is moved to the smaller class
+#ifndef SHARED_REALLOC_SHRINK_CLASSES
+#define SHARED_REALLOC_SHRINK_CLASSES 2
+#endif
+
+// a large block that shrinks to less then half keeps the next power of 2 of its new size(at least this many bytes) and
+// gives back the rest
+#ifndef SHARED_REALLOC_RELEASE_GRANULARITY
+#define SHARED_REALLOC_RELEASE_GRANULARITY (1ul << 16)
+#endif
+
+typedef struct
+{
+	// a core cache with less empty slabs then lowWatermark is refilled up to highWatermark empty slabs
+	size_t lowWatermark;
+	size_t highWatermark;
+
+	// how long the background refiller sleeps between passes
+	useconds_t interval;
+} sharedMemoryRefillConfig;
+
+#define SHARED_MEMORY_REFILL_DEFAULT_CONFIG                                                                            \
+	{                                                                                                                  \
+		SHARED_MEMORY_REFILL_LOW_WATERMARK, SHARED_MEMORY_REFILL_HIGH_WATERMARK, SHARED_MEMORY_REFILL_INTERVAL_US      \
+	}
+
+#ifndef SHARED_MEMORY_SCAVENGE_KEEP_SLABS
+#define SHARED_MEMORY_SCAVENGE_KEEP_SLABS 4
+#endif
+
+#ifndef SHARED_MEMORY_SCAVENGE_THRESHOLD
+#define SHARED_MEMORY_SCAVENGE_THRESHOLD (1ul << 20)
+#endif
+
+#ifndef SHARED_MEMORY_SCAVENGE_INTERVAL_US
+#define SHARED_MEMORY_SCAVENGE_INTERVAL_US 1000000
+#endif
+
+// the empty slabs a transfer cache keeps for its class, the rest go back to the buddy so any class can use them
+#ifndef SHARED_MEMORY_TRANSFER_CACHE_MAX_SLABS
+#define SHARED_MEMORY_TRANSFER_CACHE_MAX_SLABS 16
+#endif
+
+// a freed large block at least this big gives its pages back to the kernel right away
+#ifndef SHARED_MEMORY_RELEASE_ON_FREE_SIZE
+#define SHARED_MEMORY_RELEASE_ON_FREE_SIZE (1ul << 20)
+#endif
+
+typedef struct
+{
+	// the slabs each transfer cache keeps resident, they are the ones that are pushed last and popped first
+	size_t keepSlabs;
+
+	// a pass does nothing unless at least this many bytes of slabs were idle since the last pass
+	size_t threshold;
+
+	// how long the background scavenger sleeps between passes
+	useconds_t interval;
+} sharedMemoryScavengeConfig;
+
+#define SHARED_MEMORY_SCAVENGE_DEFAULT_CONFIG                                                                          \
+	{                                                                                                                  \
+		SHARED_MEMORY_SCAVENGE_KEEP_SLABS, SHARED_MEMORY_SCAVENGE_THRESHOLD, SHARED_MEMORY_SCAVENGE_INTERVAL_US        \
+	}
+
+/**
+ * @brief what the caches of the pool are indexed by.
+ */
+typedef enum
+{
+	// one cache for each cpu, a process that has less threads then cpus still uses a cache on every cpu it runs on
+	SHARED_MEMORY_CACHE_PER_CPU,
+
+	// one cache for each rseq mm_cid, the kernel keeps the ids of a process small and gives them to the threads that
+	// run right now, so there are never more caches then running threads. falls back to per cpu before linux 6.3.
+	SHARED_MEMORY_CACHE_PER_CID,
+
+	// one cache for each thread, taken under a lock that only that thread uses. this is what the pool falls back to
+	// if rseq can't be registered(an old kernel, seccomp, valgrind).
+	SHARED_MEMORY_CACHE_PER_THREAD,
+} sharedMemoryCacheIndex;
+
+#ifndef SHARED_MEMORY_DEFAULT_CACHE_INDEX
+#define SHARED_MEMORY_DEFAULT_CACHE_INDEX SHARED_MEMORY_CACHE_PER_CPU
+#endif
+
+// the thread caches of a pool, a thread that exits gives its caches to the next new thread and once they are all taken
+// new threads share them
+#ifndef SHARED_MEMORY_MAX_THREAD_CACHES
+#define SHARED_MEMORY_MAX_THREAD_CACHES 1024
+#endif
+
+typedef struct
+{
+	// slabs the allocating thread had to get by itself after its core cache ran out
+	uint64_t foregroundRefills;
+
+	// slabs the refiller gave to a core cache before it ran out
+	uint64_t backgroundRefills;
+} sharedMemoryRefillStats;
+
+/**
+ * @brief where the slabs of the core caches of one node came from, a core that runs out of slabs takes them from the
+ * transfer cache of its own node first and those are not counted here.
+ */
+typedef struct
+{
+	// slabs from the transfer cache of the node or new pages that the node touched first
+	uint64_t localSlabs;
+
+	// slabs from the transfer cache of another node, only when the page heap is out of memory
+	uint64_t remoteSlabs;
+} sharedMemoryNodeStats;
+
+typedef struct
+{
+	uint32_t nodeCount;
+	sharedMemoryNodeStats nodes[NUMA_MAX_NODES];
+} sharedMemoryNumaStats;
+
+// more then the size classes of any configuration, the stats only fill classCount of them
+#ifndef SHARED_MEMORY_STATS_MAX_CLASSES
+#define SHARED_MEMORY_STATS_MAX_CLASSES 32
+#endif
+
+/**
+ * @brief what the caches of one size class did, counted by each cache in the pool so they are for every process that
+ * uses it. a fast cell operation that is interrupted right before its commit is counted but not done, so they are a
+ * close estimate and not exact.
+ */
+typedef struct
+{
+	size_t cellSize;
+
+	// cells handed out and taken back by the fast cells
+	uint64_t fastAllocs;
+	uint64_t fastFrees;
+
+	// cells taken from the slabs, given back by the owner of the cache and given back by any other thread
+	uint64_t slabAllocs;
+	uint64_t slabFrees;
+	uint64_t remoteFrees;
+
+	// slabs added to a cache after it ran out, by the allocating thread or the refiller
+	uint64_t slabRefills;
+
+	// the slabs the caches have right now, the ones in the transfer caches are not counted
+	uint64_t slabCount;
+} sharedMemoryClassStats;
+
+/**
+ * @brief the caches of one cpu, concurrency id or thread slot.
+ */
+typedef struct
+{
+	uint32_t node;
+	uint32_t classCount;
+	sharedMemoryClassStats classes[SHARED_MEMORY_STATS_MAX_CLASSES];
+} sharedMemoryCacheStats;
+
+typedef struct
+{
+	sharedMemoryCacheIndex cacheIndex;
+
+	// the caches that were created, an id that never allocated has none
+	uint32_t cacheCount;
+
+	// the sum of the caches
+	uint32_t classCount;
+	sharedMemoryClassStats classes[SHARED_MEMORY_STATS_MAX_CLASSES];
+
+	// how many times a thread slept on the page heap lock, on the lock of a thread cache or on the lock of a slab cache
+	uint64_t pageHeapLockWaits;
+	uint64_t threadCacheLockWaits;
+	uint64_t slabCacheLockWaits;
+
+	// the buddy blocks in use for slabs, large blocks and caches and the size of the file they are in
+	uint64_t pageHeapBytes;
+	uint64_t fileSize;
+} sharedMemoryStats;
+
+typedef enum
+{
+	SHARED_MEMORY_STATS_TEXT,
+	SHARED_MEMORY_STATS_JSON,
+} sharedMemoryStatsFormat;
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
 	THROWS err_t initSharedMemory();
+
+	/**
+	 * @brief choose what the caches of the next pool are indexed by, it has to be called before initSharedMemory.
+	 * @note the mm_cid of a thread only means something in its own process, so a pool with per cid caches can't be
+	 * attached to, and a process without rseq can only attach to a pool with per thread caches
+	 */
+	THROWS err_t setSharedMemoryCacheIndex(sharedMemoryCacheIndex index);
+
+	/**
+	 * @brief what the caches are indexed by, after the fallback if mm_cid is not supported or rseq can't be
+	 * registered.
+	 */
+	THROWS err_t getSharedMemoryCacheIndex(sharedMemoryCacheIndex *index);
+
+	/**
+	 * @brief close the pool, in a process that attached to it this only unmaps it.
+	 * @note the process that created the pool has to close it last
+	 */
 	err_t closeSharedMemory();
 
+	/**
+	 * @brief send the pool to another process over a unix socket, it joins it with attachSharedMemory.
+	 */
+	THROWS err_t sendSharedMemory(int socketFd);
+
+	/**
+	 * @brief join a pool sent with sendSharedMemory instead of creating one, from here on this process allocates from
+	 * the same caches and page heap as the sender and a cell from one process can be freed in the other.
+	 * @note the pool can be mapped at another address then in the sender, pass getSharedMemoryHandle between the
+	 * processes and not pointers
+	 */
+	THROWS err_t attachSharedMemory(int socketFd);
+
+	/**
+	 * @brief hold the page heap lock and the locks of the thread caches across fork, for pthread_atfork(prepare, release,
+	 * release). a child with a private copy of the pool would otherwise get them held by threads it does not have.
+	 */
+	void sharedMemoryForkPrepare();
+	void sharedMemoryForkRelease();
+
 	THROWS err_t sharedAlloc(void **const data, const size_t count, const size_t size, allocatorFlags flags, void *sharedAllocatorData);
+
+	/**
+	 * @brief resize data, keeping it where it is when it can.
+	 * a slab cell is kept while the new size fits it and is no more then SHARED_REALLOC_SHRINK_CLASSES size classes
+	 * smaller, a large block is kept while the new size fits it and the tail of a block that shrinks below half is
+	 * given back to the kernel. otherwise the data is copied to a new allocation.
+	 */
 	THROWS err_t sharedRealloc(void **const data, const size_t count, const size_t size, allocatorFlags flags, void *sharedAllocatorData);
 	THROWS err_t sharedDealloc(void **const data,  void *sharedAllocatorData);
 
+	/**
+	 * @brief free data without the page heap lookup, size is the size data was allocated with(or any size that still
+	 * fits it). the slab is found from the address alone, debug builds also check it against the page heap.
+	 */
+	THROWS err_t sharedDeallocSized(void **const data, const size_t size, void *sharedAllocatorData);
+
+	/**
+	 * @brief allocate n cells of size bytes to out, the cells are taken from the core cache under one lock and up to 8
+	 * of them with one atomic operation.
+	 * @note on error nothing stays allocated.
+	 */
+	THROWS err_t sharedAllocBatch(void **out, size_t n, size_t size);
+
+	/**
+	 * @brief free n pointers, the cells of each slab are freed together.
+	 * @note ptrs is sorted in place and every freed pointer is set to NULL. a pointer that can't be freed doesn't stop
+	 * the rest, it is left as it is(with the rest of its slab in ptrs) and the first error is returned.
+	 */
+	THROWS err_t sharedFreeBatch(void **ptrs, size_t n);
+
+	/**
+	 * @brief allocate with data aligned to alignment(a power of 2), freed with sharedDealloc.
+	 * small alignments are taken from a size class that its cells are aligned enough, bigger ones from a buddy block
+	 * that is at least alignment big, the blocks are aligned to there size.
+	 */
+	THROWS err_t sharedAlignedAlloc(void **const data, const size_t count, const size_t size, const size_t alignment,
+									allocatorFlags flags, void *sharedAllocatorData);
+
+	/**
+	 * @brief how many bytes can be used from data, this is the size of the cell or block that holds it.
+	 */
+	THROWS err_t sharedGetUsableSize(void *const data, size_t *size);
+
 	/**
 	 * @brief get the shared Allocator.
 	 * this in a way is singleton as it will always will return the same shared allocator
@@ -24,7 +303,68 @@ extern "C"
 	 */
 	memoryAllocator *getSharedAllocator();
 
-  
+	/**
+	 * @brief do one pass over all the core caches and refill the ones under the low watermark.
+	 * this is what the background refiller runs, it can also be called when the process is idle.
+	 */
+	THROWS err_t refillSharedMemoryCaches(const sharedMemoryRefillConfig *config);
+
+	/**
+	 * @brief start a thread that runs refillSharedMemoryCaches every config interval.
+	 * @note the high watermark can't be above SLAB_CACHE_EMPTY_HIGH_WATERMARK or the caches will give the slabs right
+	 * back to the transfer cache.
+	 */
+	THROWS err_t startSharedMemoryRefiller(const sharedMemoryRefillConfig *config);
+	err_t stopSharedMemoryRefiller();
+
+	THROWS err_t getSharedMemoryRefillStats(sharedMemoryRefillStats *stats);
+
+	/**
+	 * @brief the slabs each numa node got from its own memory and from other nodes, in this process.
+	 */
+	THROWS err_t getSharedMemoryNumaStats(sharedMemoryNumaStats *stats);
+
+	/**
+	 * @brief give the pages of the slabs that sat in the transfer caches since the last pass back to the kernel,
+	 * except the keepSlabs that will be used next. the slab header page stays so the slab can be used again right away.
+	 */
+	THROWS err_t scavengeSharedMemory(const sharedMemoryScavengeConfig *config, size_t *releasedBytes);
+
+	/**
+	 * @brief start a thread that runs scavengeSharedMemory every config interval.
+	 */
+	THROWS err_t startSharedMemoryScavenger(const sharedMemoryScavengeConfig *config);
+	err_t stopSharedMemoryScavenger();
+
+	/**
+	 * @brief give back the pages of every slab in the transfer caches now, releasedBytes can be NULL.
+	 * slabs in the core caches are left alone, those are the ones the cores will allocate from next.
+	 * slabs above SHARED_MEMORY_TRANSFER_CACHE_MAX_SLABS are also given back to the buddy.
+	 */
+	THROWS err_t sharedMemoryTrim(size_t *releasedBytes);
+
+	/**
+	 * @brief add up the stats of every cache of the pool, they live in the pool so a process that attached to it
+	 * reads the numbers of all the processes while they run.
+	 */
+	THROWS err_t getSharedMemoryStats(sharedMemoryStats *stats);
+
+	/**
+	 * @brief the stats of the caches of one id, ENOENT if they were not created.
+	 * @param id a cpu, a concurrency id or a thread slot, below getSharedMemoryCacheCount
+	 */
+	THROWS err_t getSharedMemoryCacheStats(uint32_t id, sharedMemoryCacheStats *stats);
+
+	/**
+	 * @brief how many ids can have caches, the caches of each are in getSharedMemoryCacheStats.
+	 */
+	THROWS err_t getSharedMemoryCacheCount(uint32_t *count);
+
+	/**
+	 * @brief write getSharedMemoryStats and the caches that were created to fd, as a table or as one json object.
+	 */
+	THROWS err_t dumpSharedMemoryStats(int fd, sharedMemoryStatsFormat format);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "types/err_t.h"
+
+#include <stdint.h>
+
+struct slab;
+
+/**
+ * @brief a central list of whole slabs for one size class, the per core caches give it slabs they don't need and take
+ * slabs from it before asking the buddy for new ones.
+ * @note thank you to tcmalloc for the idea.
+ *
+ * the list is a lock free stack, the head keeps the offset of the first slab from the cache itself and a tag that change
+ * on every update so a slab that was popped and pushed back between our read and our compare and swap can't fool
+ * us(ABA). there is no address in it, so it works wherever the pool is mapped.
+ */
+typedef struct
+{
+	uint64_t head;
+	uint64_t slabCount;
+
+	// the lowest slabCount since the last transferCacheTakeIdleCount, that many slabs were not needed the whole time
+	uint64_t minSlabCount;
+} transferCache;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	THROWS err_t initTransferCache(transferCache *cache);
+
+	/**
+	 * @brief push a chain of slabs linked by there nextSlab with one compare and swap.
+	 */
+	THROWS err_t transferCachePush(transferCache *cache, slab *first, slab *last, size_t count);
+
+	/**
+	 * @brief pop one slab, s is set to NULL if the transfer cache is empty.
+	 */
+	THROWS err_t transferCachePop(transferCache *cache, slab **s);
+
+	/**
+	 * @brief pop all the slabs as one chain(from the last pushed to the first) linked by there nextSlab.
+	 */
+	THROWS err_t transferCachePopAll(transferCache *cache, slab **first, slab **last, size_t *count);
+
+	/**
+	 * @brief how many slabs stayed in the cache since the last call, and start counting again.
+	 */
+	THROWS err_t transferCacheTakeIdleCount(transferCache *cache, size_t *idleCount);
+
+#ifdef __cplusplus
+}
+#endif
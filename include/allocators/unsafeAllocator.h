@@ -1,5 +1,10 @@
 #pragma once
 
+#include "allocators/transferCache.h"
+#include "memoryUtils/allocatorsConfig.h"
+#include "memoryUtils/offsetPtr.h"
+#include "os/futexLock.h"
+#include "os/rseqOps.h"
 #include "types/dynamicArray.h"
 #include "types/err_t.h"
 #include "types/memoryAllocator.h"
@@ -12,18 +17,79 @@
 #define SLAB_MAGIC 0xABABABABABABABAB
 #endif
 
-extern bool isInRseq;
+// how many empty slabs a cache keeps before it gives the rest to the transfer cache, and how many it keeps after that
+#ifndef SLAB_CACHE_EMPTY_HIGH_WATERMARK
+#define SLAB_CACHE_EMPTY_HIGH_WATERMARK 4
+#endif
+
+#ifndef SLAB_CACHE_EMPTY_LOW_WATERMARK
+#define SLAB_CACHE_EMPTY_LOW_WATERMARK 1
+#endif
+
+// the most cells a cache keeps in front of its slabs, and the most bytes of cells so the big classes keep less of them
+#ifndef SLAB_CACHE_FAST_CELLS
+#define SLAB_CACHE_FAST_CELLS 32
+#endif
+
+#ifndef SLAB_CACHE_FAST_BYTES
+#define SLAB_CACHE_FAST_BYTES (SLAB_SIZE / 2)
+#endif
 
 struct slab;
+struct slabCache;
+
+typedef enum : uint8_t
+{
+	SLAB_DETACHED,
+	SLAB_ON_PARTIAL_LIST,
+	SLAB_ON_FULL_LIST,
+	SLAB_ON_EMPTY_LIST,
+} slabList;
 
+/**
+ * @note every link is an offsetPtr so the slabs stay valid in every process that maps the pool, wherever it is mapped.
+ */
 typedef struct {
 	uint64_t slabMagic;
-	slab *nextSlab;
+	offsetPtr<slab> nextSlab;
+
+	// the partial and full lists are doubly linked so the owner can move a slab between them in O(1)
+	offsetPtr<slab> prevSlab;
+	offsetPtr<slab> nextFreedSlab;
+	offsetPtr<slab> nextEmptiedSlab;
+	offsetPtr<slabCache> owner;
+
+	// cells freed from other cores, linked through an offsetPtr in the first word of the cell. the owner clear there
+	// bits in batches.
+	atomicOffsetPtr<void> remoteFreeCells;
+	offsetPtr<slab> nextRemoteFreedSlab;
+
 	size_t cellSize;
+
+	// cells that are allocated or waiting on remoteFreeCells, when it gets to 0 the slab is given back to the owner.
+	// the top bit is SLAB_EMPTIED_PENDING
+	uint32_t usedCells;
+
+	// the byte in the free list where the next search for a free cell starts, so a slab that is filling up doesn't
+	// rescan the bytes it already knows are full
+	uint32_t freeListHint;
+
 	bool isSlabFull;
+
+	// the pages after the free list were given back to the kernel while the slab was in the transfer cache
+	bool isReleased;
+
+	// only changed by the owner
+	slabList list;
 } slabHead;
 
-static const constexpr size_t SLAB_CACHE_SIZE = (SLAB_SIZE - sizeof(slabHead));
+// set in usedCells by the free that brought it to 0, in the same cas, until the owner takes the slab off emptiedSlabs.
+// the owner only reclaims a slab after it cleared the bit, so the free is done with the slab by then
+#define SLAB_EMPTIED_PENDING (1u << 31)
+
+using defaultSlabLayout = slabLayout<SLAB_SIZE, sizeof(slabHead)>;
+
+static const constexpr size_t SLAB_CACHE_SIZE = defaultSlabLayout::cacheSize;
 
 typedef struct slab
 {
@@ -31,6 +97,173 @@ typedef struct slab
 	uint8_t cache[SLAB_CACHE_SIZE];
 } slab;
 
+/**
+ * @brief what the ownerId of a slab cache is compared with to tell a local free from a remote one.
+ */
+typedef enum : uint8_t
+{
+	SLAB_CACHE_OWNER_CPU,
+
+	// the rseq mm_cid of the thread, a small id that is only used by one thread of the process at a time
+	SLAB_CACHE_OWNER_MM_CID,
+
+	// currentThreadCacheId, the cache is used by the threads that share that id under a lock and not in a rseq
+	SLAB_CACHE_OWNER_THREAD,
+} slabCacheOwnerKind;
+
+// the id of the thread cache this thread uses, NO_SLAB_CACHE_OWNER if it has none
+extern thread_local uint32_t currentThreadCacheId;
+
+/**
+ * @brief what a slab cache did, every thread counts with an atomic so no count is lost. the pushes and pops of the fast
+ * cells are counted in fastCellsState by the store that commits them.
+ */
+typedef struct
+{
+	// cells taken from the slabs and given back to them by the owner, and the ones any other thread gave back
+	uint64_t slabAllocs;
+	uint64_t slabFrees;
+	uint64_t remoteFrees;
+
+	// slabs added to the cache after it ran out of empty ones, by the allocating thread or the refiller
+	uint64_t slabRefills;
+
+	// the slabs the cache has on all of its lists
+	uint64_t slabCount;
+} slabCacheStats;
+
+/**
+ * @brief all the slabs of one size class on one core, split by how full they are so an allocation always starts on a
+ * slab that has room.
+ *
+ * @note partialSlabs and fullSlabs are only changed under lock, the other lists can be pushed to from anywhere and are
+ * moved to the partial list by whoever holds it.
+ */
+typedef struct slabCache
+{
+	// taken around unsafeAlloc and unsafeAllocBatch, a free never takes it. the slab lists are linked in a few stores
+	// each so they can't be in a rseq, an abort in the middle would leave them half linked
+	futexLock lock;
+
+	offsetPtr<slab> partialSlabs;
+	offsetPtr<slab> fullSlabs;
+	atomicOffsetPtr<slab> emptySlabs;
+	size_t emptySlabCount;
+
+	// full slabs that had a cell freed, linked by nextFreedSlab as they are still on the full list
+	atomicOffsetPtr<slab> freedFullSlabs;
+
+	// slabs that had there last cell freed, linked by nextEmptiedSlab
+	atomicOffsetPtr<slab> emptiedSlabs;
+
+	// slabs that have remoteFreeCells, linked by nextRemoteFreedSlab
+	atomicOffsetPtr<slab> remoteFreedSlabs;
+
+	// where empty slabs above SLAB_CACHE_EMPTY_HIGH_WATERMARK go and where we look before running out of slabs, can be
+	// NULL
+	offsetPtr<transferCache> centralCache;
+
+	size_t cellSize;
+
+	// the slab geometry of cellSize, calculated once when the cache is created so the hot path only loads them
+	size_t freeListSize;
+	size_t firstCellOffset;
+	uint64_t cellSizeReciprocal;
+
+	// the core(or concurrency id) that allocates from this cache, a free from any other goes to the slab
+	// remoteFreeCells.
+	uint32_t ownerId;
+	slabCacheOwnerKind ownerKind;
+
+	// cells that stay allocated on there slab and are handed out and taken back with a single rseq each, the slots
+	// are the distance of the cell from the cache. only the owner changes them. the state is how many there are and
+	// how many pushes and pops were done, see RSEQ_STACK_COUNT_BITS
+	uint64_t fastCellsState;
+	uint64_t fastCellsCapacity;
+	intptr_t fastCells[SLAB_CACHE_FAST_CELLS];
+
+	slabCacheStats stats;
+} slabCache;
+
+// a slab cache with this owner treat every free as local
+#define NO_SLAB_CACHE_OWNER UINT32_MAX
+
+static_assert(SLAB_CACHE_FAST_CELLS <= RSEQ_STACK_MAX_COUNT, "the fast cells count has to fit the rseq stack state");
+
+static inline size_t getFastCellsCapacity(size_t cellSize)
+{
+	size_t capacity = SLAB_CACHE_FAST_BYTES / cellSize;
+
+	if (capacity > SLAB_CACHE_FAST_CELLS)
+	{
+		return SLAB_CACHE_FAST_CELLS;
+	}
+
+	return capacity > 0 ? capacity : 1;
+}
+
+static inline rseqIdKind getSlabCacheIdKind(const slabCache *cache)
+{
+	return cache->ownerKind == SLAB_CACHE_OWNER_MM_CID ? RSEQ_ID_MM_CID : RSEQ_ID_CPU;
+}
+
+/**
+ * @brief take a fast cell of the cache, it has to be the cache of the core or concurrency id we are on.
+ * a thread cache is only used under its lock so there is nothing to restart, they are a plain stack.
+ * @return false if it has none, we are not the owner or we were interrupted, the cell then comes from unsafeAlloc.
+ */
+static inline bool slabCachePopFastCell(slabCache *cache, void **cell)
+{
+	intptr_t offset = 0;
+
+	if (cache->ownerKind == SLAB_CACHE_OWNER_THREAD)
+	{
+		if (cache->ownerId != currentThreadCacheId || rseqStackCount(cache->fastCellsState) == 0)
+		{
+			return false;
+		}
+
+		offset = cache->fastCells[rseqStackCount(cache->fastCellsState) - 1];
+		cache->fastCellsState += RSEQ_STACK_POP;
+	}
+	else if (!rseqStackPop(&cache->fastCellsState, cache->fastCells, cache->ownerId, getSlabCacheIdKind(cache),
+						   &offset))
+	{
+		return false;
+	}
+
+	*cell = (void *)((intptr_t)cache + offset);
+	return true;
+}
+
+/**
+ * @brief give a cell that was allocated from cache back to its fast cells, without touching the slab.
+ * @note the caller holds the lock of a thread cache
+ * @return false if they are full, we are not the owner or we were interrupted, the cell then goes to unsafeDealloc.
+ */
+static inline bool slabCachePushFastCell(slabCache *cache, void *cell)
+{
+	if (cache->ownerId == NO_SLAB_CACHE_OWNER)
+	{
+		return false;
+	}
+
+	if (cache->ownerKind == SLAB_CACHE_OWNER_THREAD)
+	{
+		if (cache->ownerId != currentThreadCacheId || rseqStackCount(cache->fastCellsState) >= cache->fastCellsCapacity)
+		{
+			return false;
+		}
+
+		cache->fastCells[rseqStackCount(cache->fastCellsState)] = (intptr_t)cell - (intptr_t)cache;
+		cache->fastCellsState += RSEQ_STACK_PUSH;
+		return true;
+	}
+
+	return rseqStackPush(&cache->fastCellsState, cache->fastCells, cache->fastCellsCapacity, cache->ownerId,
+						 getSlabCacheIdKind(cache), (intptr_t)cell - (intptr_t)cache);
+}
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -38,12 +271,70 @@ extern "C"
 
 
 	/**
-	 * @brief create a allocator that can be called from a resq or a critical section
-	 * @see man resq(2)
+	 * @brief create a allocator that is not thread safe, the allocations of a cache have to hold its lock(or come from
+	 * one thread). the allocator data is the slab cache, realloc and free get the slab that hold the cell as there data.
+	 * aligned allocations only work up to the alignment of the cache cells.
 	 * @return memoryAllocator*
 	 */
-	THROWS err_t createUnsafeAllocator(memoryAllocator *res, slab *firstSlab, size_t cellSize);
-	THROWS err_t appendSlab(memoryAllocator *unsafeAllocator, slab *newSlab);
+	THROWS err_t createUnsafeAllocator(memoryAllocator *res, slabCache *cache, slab *firstSlab, size_t cellSize);
+
+	/**
+	 * @brief the free list search unsafeAlloc uses, the index of a zero bit in freeList from the byte hint on(wrapping
+	 * around) or -1 if there is none. it is here for the benchmarks.
+	 */
+	int unsafeFindFreeCell(const uint8_t *freeList, size_t freeListSize, size_t hint);
+
+	THROWS err_t initSlabCache(slabCache *cache, size_t cellSize, uint32_t ownerId, slabCacheOwnerKind ownerKind,
+							   transferCache *centralCache);
+
+	/**
+	 * @brief give a new slab to the cache, it will be used once the partial slabs run out.
+	 * @note this is lock free and can be called from any core.
+	 */
+	THROWS err_t appendSlab(slabCache *cache, slab *newSlab);
+
+	THROWS err_t unsafeAlloc(void **const ptr, const size_t count, const size_t size, allocatorFlags flags,
+							 void *slabCacheData);
+
+	/**
+	 * @brief unsafeAlloc for a cache that its cells are aligned to alignment, fails with EINVAL if they are not.
+	 */
+	THROWS err_t unsafeAlignedAlloc(void **const ptr, const size_t count, const size_t size, const size_t alignment,
+									allocatorFlags flags, void *slabCacheData);
+	THROWS err_t unsafeRealloc(void **const ptr, const size_t count, const size_t size, allocatorFlags flags,
+							   void *slabData);
+
+	/**
+	 * @brief free a cell, if we are not on the cache owner core the cell is pushed to the slab remote free list
+	 * instead of touching the bitmap so the bitmap cache lines stay on the owner core.
+	 */
+	THROWS err_t unsafeDealloc(void **const ptr, void *slabData);
+
+	/**
+	 * @brief the checks unsafeDealloc does before it frees ptr, fails if it is not the start of an allocated cell of
+	 * the slab. for a free that skips the slab, like a push to the fast cells.
+	 */
+	THROWS err_t unsafeCheckCell(const void *ptr, void *slabData);
+
+	/**
+	 * @brief unsafeDealloc that also checks size fits the cell.
+	 */
+	THROWS err_t unsafeDeallocSized(void **const ptr, const size_t size, void *slabData);
+
+	/**
+	 * @brief allocate count - *allocatedCount cells to ptrs[*allocatedCount...], up to 8 cells are claimed with one
+	 * atomic or on the free list.
+	 * @note the caller holds the cache lock, if it fails allocatedCount still counts the cells it did get.
+	 */
+	THROWS err_t unsafeAllocBatch(void **const ptrs, const size_t count, size_t *allocatedCount, void *slabCacheData);
+
+	/**
+	 * @brief free count cells that all belong to the slab slabData, nothing is freed if one of them is not valid or if
+	 * a cell is twice in a row.
+	 * cells that share a byte of the free list are cleared with one atomic and, so sorted ptrs are freed faster.
+	 * a batch from a core that doesn't own the slab is pushed to the remote free list as one chain.
+	 */
+	THROWS err_t unsafeDeallocBatch(void **const ptrs, const size_t count, void *slabData);
 
 #ifdef __cplusplus
 }
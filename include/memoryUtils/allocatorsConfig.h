@@ -0,0 +1,223 @@
+/**
+ * @file allocatorsConfig.h
+ * @brief compile time configuration of the shared pool, the size classes, the slab geometry and the page heap backend
+ * are template parameters and everything the hot path need from them is calculated here at compile time.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+/**
+ * @brief where the cells of a slab are for a given cell size.
+ * the slab is the header, then the free list(one bit per cell) then one spare byte and then the cells, the first cell
+ * is pushed up so every cell is aligned to cellAlignment.
+ *
+ * @note the slab itself has to be aligned to maxCellAlignment.
+ */
+template <size_t slabSize, size_t slabHeaderSize, size_t maxCellAlignment = 64> struct slabLayout
+{
+	static_assert(slabSize > slabHeaderSize, "the slab header has to fit in the slab");
+	static_assert((maxCellAlignment & (maxCellAlignment - 1)) == 0, "the alignment has to be a power of 2");
+
+	static constexpr const size_t size = slabSize;
+	static constexpr const size_t cacheSize = slabSize - slabHeaderSize;
+	static constexpr const size_t maxAlignment = maxCellAlignment;
+
+	static constexpr size_t freeListSize(size_t cellSize)
+	{
+		return (cacheSize / cellSize + 7) / 8;
+	}
+
+	/**
+	 * @brief the biggest power of 2 that divide the cell size(up to maxCellAlignment), all the cells are aligned to it.
+	 */
+	static constexpr size_t cellAlignment(size_t cellSize)
+	{
+		size_t alignment = cellSize & (~cellSize + 1);
+		return alignment > maxCellAlignment ? maxCellAlignment : alignment;
+	}
+
+	/**
+	 * @brief the offset of the first cell from the end of the header.
+	 */
+	static constexpr size_t firstCellOffset(size_t cellSize)
+	{
+		size_t alignment = cellAlignment(cellSize);
+		return ((slabHeaderSize + freeListSize(cellSize) + 1 + alignment - 1) & ~(alignment - 1)) - slabHeaderSize;
+	}
+
+	static constexpr size_t cellCount(size_t cellSize)
+	{
+		return (cacheSize - firstCellOffset(cellSize)) / cellSize;
+	}
+
+	/**
+	 * @brief ceil(2^32 / cellSize), offset * reciprocal >> 32 is offset / cellSize for every offset in the slab.
+	 * the error of the ceil is less then cellSize so it is exact as long as cacheSize * cellSize < 2^32.
+	 */
+	static constexpr uint64_t cellSizeReciprocal(size_t cellSize)
+	{
+		return ((1ul << 32) + cellSize - 1) / cellSize;
+	}
+
+	static constexpr size_t cellIndex(size_t offsetFromFirstCell, uint64_t reciprocal)
+	{
+		return (offsetFromFirstCell * reciprocal) >> 32;
+	}
+};
+
+/**
+ * @brief a buddy allocator over 2^maxRangeExponent bytes that gives blocks of at least 2^minBlockExponent bytes.
+ */
+template <size_t maxRangeExponent, size_t minBlockExponent> struct buddyBackend
+{
+	static_assert(maxRangeExponent > minBlockExponent);
+
+	static constexpr const size_t rangeExponent = maxRangeExponent;
+	static constexpr const size_t blockExponent = minBlockExponent;
+	static constexpr const size_t rangeSize = 1ul << maxRangeExponent;
+	static constexpr const size_t minBlockSize = 1ul << minBlockExponent;
+};
+
+/**
+ * @brief the full pool configuration.
+ *
+ * @tparam sizeClasses a constexpr array of the cell sizes, sorted from small to big
+ * @tparam layout a slabLayout
+ * @tparam backend the page heap that gives the slabs and the allocations that are to big for a slab, a buddyBackend
+ * @tparam lookupGranularity the size step of the size class lookup table
+ */
+template <const auto &sizeClasses, typename layout, typename backend, size_t lookupGranularity = 16,
+		  size_t minAlignment = 16>
+struct poolConfig
+{
+	using slabLayoutType = layout;
+	using backendType = backend;
+
+	static constexpr const size_t classCount = std::size(sizeClasses);
+	static constexpr const size_t maxCellSize = sizeClasses[classCount - 1];
+	static constexpr const size_t lookupSize = maxCellSize / lookupGranularity + 2;
+
+	// every cell of every class is aligned at least to this, isValidSizeClassList makes sure of it
+	static constexpr const size_t minCellAlignment = layout::cellAlignment(minAlignment);
+
+	static_assert(classCount > 0 && classCount < UINT8_MAX);
+	static_assert(layout::size <= backend::minBlockSize, "a slab has to fit in the smallest block of the backend");
+	static_assert(layout::cacheSize * maxCellSize < (1ul << 32), "the cell reciprocal will not be exact");
+
+	static constexpr bool isValidSizeClassList()
+	{
+		for (size_t i = 1; i < classCount; i++)
+		{
+			// the lookup table gives the smallest class that can be in the bucket and we check one more class after it,
+			// that only works if there is at most one class boundary in each bucket.
+			if (sizeClasses[i] < sizeClasses[i - 1] + lookupGranularity)
+			{
+				return false;
+			}
+		}
+
+		for (size_t i = 0; i < classCount; i++)
+		{
+			// every cell has to be aligned at least like malloc
+			if (sizeClasses[i] % minAlignment != 0)
+			{
+				return false;
+			}
+		}
+
+		return sizeClasses[0] > 0 && layout::cellCount(maxCellSize) > 0;
+	}
+
+	static_assert(isValidSizeClassList(), "size classes must be sorted, at least lookupGranularity apart, multiples of "
+										  "minAlignment and the biggest one has to fit a slab");
+
+	/**
+	 * @brief for each bucket of lookupGranularity sizes the smallest class that can hold the first size in it.
+	 */
+	static constexpr const std::array<uint8_t, lookupSize> sizeClassLookup = []() {
+		std::array<uint8_t, lookupSize> table{};
+		size_t sizeClass = 0;
+
+		for (size_t i = 0; i < lookupSize; i++)
+		{
+			while (sizeClass < classCount && sizeClasses[sizeClass] < (i == 0 ? 0 : (i - 1) * lookupGranularity + 1))
+			{
+				sizeClass++;
+			}
+
+			table[i] = sizeClass;
+		}
+
+		return table;
+	}();
+
+	static constexpr const std::array<size_t, classCount> cellsPerSlab = []() {
+		std::array<size_t, classCount> res{};
+		for (size_t i = 0; i < classCount; i++)
+		{
+			res[i] = layout::cellCount(sizeClasses[i]);
+		}
+		return res;
+	}();
+
+	static constexpr const std::array<size_t, classCount> freeListSizes = []() {
+		std::array<size_t, classCount> res{};
+		for (size_t i = 0; i < classCount; i++)
+		{
+			res[i] = layout::freeListSize(sizeClasses[i]);
+		}
+		return res;
+	}();
+
+	static constexpr const std::array<uint64_t, classCount> cellSizeReciprocals = []() {
+		std::array<uint64_t, classCount> res{};
+		for (size_t i = 0; i < classCount; i++)
+		{
+			res[i] = layout::cellSizeReciprocal(sizeClasses[i]);
+		}
+		return res;
+	}();
+
+	/**
+	 * @brief one table load and one compare.
+	 * @return the size class or UINT32_MAX if the size is to big for a slab
+	 */
+	static constexpr uint32_t getSizeClass(size_t size)
+	{
+		uint32_t sizeClass = 0;
+
+		if (size > maxCellSize)
+		{
+			return UINT32_MAX;
+		}
+
+		sizeClass = sizeClassLookup[(size + lookupGranularity - 1) / lookupGranularity];
+		return sizeClass + (size > sizeClasses[sizeClass]);
+	}
+
+	/**
+	 * @brief the smallest class that can hold size and that its cells are aligned to alignment.
+	 * @return the size class or UINT32_MAX if no class is big enough or aligned enough
+	 */
+	static constexpr uint32_t getAlignedSizeClass(size_t size, size_t alignment)
+	{
+		uint32_t sizeClass = getSizeClass(size);
+
+		if (alignment > layout::maxAlignment)
+		{
+			return UINT32_MAX;
+		}
+
+		while (sizeClass < classCount && layout::cellAlignment(sizeClasses[sizeClass]) < alignment)
+		{
+			sizeClass++;
+		}
+
+		return sizeClass < classCount ? sizeClass : UINT32_MAX;
+	}
+};
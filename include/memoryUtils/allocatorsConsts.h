@@ -4,6 +4,9 @@
 
 #include "types/buddyAllocator.h"
 
+#include "allocators/unsafeAllocator.h"
+#include "memoryUtils/allocatorsConfig.h"
+
 // this 16GiB(2^34B) most system won't even by able to allocate that much ever so there will be errors out of memry most
 // likly before we reach that
 static constexpr const size_t MAX_RANGE_EXPONENT = 34;
@@ -23,8 +26,13 @@ static buddyAllocator *g_buddy = nullptr;
 #ifndef SLAB_ALLOCATION_CACHES_SIZES
 #define SLAB_ALLOCATION_CACHES_SIZES                                                                                   \
 	{                                                                                                                  \
-		32, 64, 128, 255, 510, 1020, 2040, 4080, 8180                                                                  \
+		32, 64, 128, 256, 512, 1024, 2048, 4080, 8160                                                                  \
 	}
 #endif
 
 const constexpr inline size_t allocationCachesSizes[] = SLAB_ALLOCATION_CACHES_SIZES;
+
+static constexpr const size_t SIZE_CLASSES_COUNT = sizeof(allocationCachesSizes) / sizeof(size_t);
+
+using defaultPoolConfig =
+	poolConfig<allocationCachesSizes, defaultSlabLayout, buddyBackend<MAX_RANGE_EXPONENT, MIN_BUDDY_BLOCK_SIZE_EXPONENT>>;
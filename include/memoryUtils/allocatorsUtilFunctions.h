@@ -6,21 +6,9 @@
 
 #include "allocatorsConsts.h"
 
-// all the buddy allocators are alligned so all the pointers on a certien slab can give the slab when you mask them out
-// and you add 1 as this is the buddy mangement data
-#define GET_SLAB_START(data) (slab*)(((size_t)data & (~0lu << 13)) + 1)
-
 static constexpr uint32_t getSizeClass(const size_t size)
 {
-   for(size_t i = 0; i < sizeof(allocationCachesSizes) / sizeof(size_t); i++)
-  {
-    if(size <= allocationCachesSizes[i])
-    {
-      return i;
-    }
-  }
-
-  return UINT32_MAX;
+	return defaultPoolConfig::getSizeClass(size);
 }
 
 /**
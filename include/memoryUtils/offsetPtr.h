@@ -0,0 +1,144 @@
+/**
+ * @file offsetPtr.h
+ * @brief pointers that keep the distance from where they are stored to what they point at instead of an address, so a
+ * structure in the shared memory stays valid wherever a process maps it.
+ * @note thank you to boost.interprocess for the idea.
+ *
+ * the offset is from the pointer itself and not from the start of the pool, so reading one is a single add with no
+ * global to load(it is used inside the rseq) and a slab that is not in the pool can use them too.
+ * 0 is NULL, a pointer to itself is never needed.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OFFSET_PTR_INLINE __attribute__((always_inline)) inline
+
+typedef int64_t rawOffsetPtr;
+
+/**
+ * @brief the address an offset points at if it is stored in ptr, for an offset that was loaded atomically.
+ */
+static OFFSET_PTR_INLINE void *rawOffsetPtrResolve(const rawOffsetPtr *ptr, rawOffsetPtr offset)
+{
+	return offset == 0 ? NULL : (void *)((intptr_t)ptr + offset);
+}
+
+static OFFSET_PTR_INLINE void *rawOffsetPtrGet(const rawOffsetPtr *ptr)
+{
+	return rawOffsetPtrResolve(ptr, *ptr);
+}
+
+static OFFSET_PTR_INLINE rawOffsetPtr rawOffsetPtrMake(const rawOffsetPtr *ptr, const void *target)
+{
+	return target == NULL ? 0 : (intptr_t)target - (intptr_t)ptr;
+}
+
+static OFFSET_PTR_INLINE void rawOffsetPtrSet(rawOffsetPtr *ptr, const void *target)
+{
+	*ptr = rawOffsetPtrMake(ptr, target);
+}
+
+#define OFFSET_PTR_GET(type, ptr) ((type *)rawOffsetPtrGet(&(ptr)))
+#define OFFSET_PTR_SET(ptr, target) rawOffsetPtrSet(&(ptr), (target))
+
+#ifdef __cplusplus
+
+/**
+ * @brief a rawOffsetPtr that acts like a T *.
+ * @note copying one copies the address it points at, not the offset, so a copy somewhere else still points at the
+ * same place.
+ */
+template <typename T> class offsetPtr
+{
+  public:
+	offsetPtr() = default;
+
+	OFFSET_PTR_INLINE offsetPtr(T *target)
+	{
+		rawOffsetPtrSet(&offset, target);
+	}
+
+	OFFSET_PTR_INLINE offsetPtr(const offsetPtr &other)
+	{
+		rawOffsetPtrSet(&offset, other.get());
+	}
+
+	OFFSET_PTR_INLINE offsetPtr &operator=(const offsetPtr &other)
+	{
+		rawOffsetPtrSet(&offset, other.get());
+		return *this;
+	}
+
+	OFFSET_PTR_INLINE offsetPtr &operator=(T *target)
+	{
+		rawOffsetPtrSet(&offset, target);
+		return *this;
+	}
+
+	OFFSET_PTR_INLINE T *get() const
+	{
+		return (T *)rawOffsetPtrGet(&offset);
+	}
+
+	OFFSET_PTR_INLINE operator T *() const
+	{
+		return get();
+	}
+
+	OFFSET_PTR_INLINE T *operator->() const
+	{
+		return get();
+	}
+
+  private:
+	rawOffsetPtr offset;
+};
+
+/**
+ * @brief an offsetPtr that is changed with atomics, the offset is only relative to the field so comparing and swapping
+ * the offsets is the same as comparing and swapping the pointers.
+ */
+template <typename T> class atomicOffsetPtr
+{
+  public:
+	atomicOffsetPtr() = default;
+	atomicOffsetPtr(const atomicOffsetPtr &) = delete;
+	atomicOffsetPtr &operator=(const atomicOffsetPtr &) = delete;
+
+	OFFSET_PTR_INLINE T *load() const
+	{
+		return (T *)rawOffsetPtrResolve(&offset, __atomic_load_n(&offset, __ATOMIC_SEQ_CST));
+	}
+
+	OFFSET_PTR_INLINE void store(T *target)
+	{
+		__atomic_store_n(&offset, rawOffsetPtrMake(&offset, target), __ATOMIC_SEQ_CST);
+	}
+
+	OFFSET_PTR_INLINE T *exchange(T *target)
+	{
+		return (T *)rawOffsetPtrResolve(
+			&offset, __atomic_exchange_n(&offset, rawOffsetPtrMake(&offset, target), __ATOMIC_SEQ_CST));
+	}
+
+	/**
+	 * @brief like atomic_compare_exchange_weak, expected is updated to what is there if it fails.
+	 */
+	OFFSET_PTR_INLINE bool compareExchangeWeak(T *&expected, T *desired)
+	{
+		rawOffsetPtr expectedOffset = rawOffsetPtrMake(&offset, expected);
+		bool isExchanged = __atomic_compare_exchange_n(&offset, &expectedOffset, rawOffsetPtrMake(&offset, desired),
+													   true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+		expected = (T *)rawOffsetPtrResolve(&offset, expectedOffset);
+		return isExchanged;
+	}
+
+  private:
+	rawOffsetPtr offset;
+};
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ * @file futexLock.h
+ * @brief a lock that stays in user space when it is not contended, spin for a bit and then sleep on a futex.
+ * the lock is a single word(and a counter for the stats) with no process local data so it can be placed in the shared
+ * memory and be used from all the processes that map it.
+ */
+
+#pragma once
+#include "types/err_t.h"
+
+#include <stdint.h>
+
+#ifndef FUTEX_LOCK_SPIN_COUNT
+#define FUTEX_LOCK_SPIN_COUNT 128
+#endif
+
+typedef struct
+{
+	// 0 - unlocked, 1 - locked, 2 - locked and there might be waiters
+	uint32_t state;
+
+	// how many times a thread had to sleep on the lock
+	uint32_t waits;
+} futexLock;
+
+#define FUTEX_LOCK_INITIALIZER {0, 0}
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	THROWS err_t initFutexLock(futexLock *lock);
+
+	/**
+	 * @brief take the lock, an uncontended lock is one compare and swap with no syscall.
+	 */
+	THROWS err_t futexLockAcquire(futexLock *lock);
+
+	/**
+	 * @brief release the lock, the futex is only woken if someone might be waiting on it.
+	 */
+	THROWS err_t futexLockRelease(futexLock *lock);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,32 @@
+/**
+ * @file numa.h
+ * @brief the numa topology of the machine, how many nodes there are and which node every cpu is on.
+ */
+
+#pragma once
+#include "types/err_t.h"
+
+#include <stdint.h>
+
+#ifndef NUMA_MAX_NODES
+#define NUMA_MAX_NODES 64
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	/**
+	 * @brief the number of numa nodes, 1 on a machine without numa(or without sysfs).
+	 */
+	THROWS err_t getNumaNodeCount(uint32_t *nodeCount);
+
+	/**
+	 * @brief the node that cpu is on, 0 if the kernel doesn't say.
+	 */
+	THROWS err_t getCpuNumaNode(uint32_t cpu, uint32_t nodeCount, uint32_t *node);
+
+#ifdef __cplusplus
+}
+#endif
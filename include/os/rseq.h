@@ -13,45 +13,52 @@
 #include "types/err_t.h"
 
 #include <linux/rseq.h>
+#include <stddef.h>
+#include <stdint.h>
 
+// the 4 bytes the kernel checks before it jumps to an abort handler, the same one glibc uses on x86
+#ifndef RSEQ_SIG
+#define RSEQ_SIG 0x53053053
+#endif
 
+#define RSEQ_STR_(x) #x
+#define RSEQ_STR(x) RSEQ_STR_(x)
 
-#define USED_IN_RSEQ __attribute__((section("rseq")))
-
+// our own area, registered only if libc did not register one
 extern volatile thread_local struct rseq r ;
 
-typedef err_t (*rseqCallback)(void *data);
-typedef err_t (*rseqAbortHandlerCallback)(bool *shouldRetry, void *data);
+// glibc(2.35 and up) registers an area for every thread it creates, it is at libcRseqOffset from the thread pointer
+extern bool isLibcRseqArea;
+extern ptrdiff_t libcRseqOffset;
+
+/**
+ * @brief the rseq area the kernel fills for this thread.
+ * @note before rseqInit runs on this thread it can be our own area that is not registered yet, its cpu_id is
+ * RSEQ_CPU_ID_UNINITIALIZED
+ */
+static inline __attribute__((always_inline)) volatile struct rseq *getRseqArea()
+{
+	if (isLibcRseqArea) [[likely]]
+	{
+		return (volatile struct rseq *)((uint8_t *)__builtin_thread_pointer() + libcRseqOffset);
+	}
+
+	return &r;
+}
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
   /**
-   * @brief register in the linux rseq
+   * @brief register in the linux rseq, if libc already registered an area for this thread we use it and there is
+   * nothing to do.
    * 
    * @return if the rseq failed to register 
    */
   
   THROWS err_t rseqInit();
 
-  /**
-   * @brief a wrapper to linux rseq, 
-   * this promise that rseqFunc will start and end on the same cpu core without any interrupts.
-   * @note 
-   * if there is any interrupts then the abort handler will be called and then it eill retry to call the rseqFunc
-   *
-   * @note
-   * the rseq func and the function that it calls has to be marked with USED_IN_RSEQ, so they will in the rseq section on the final elf.
-   * 
-   * @param maxRetires how many time should it try to call rseqFunc
-   * @param rseqFunc the function to call as rseq
-   * @param abortHandler the function to call if the rseq was interrupted.
-   * @param data a pointer that will be passed to both functions.
-   * @return THROWS if there was an error in one of the function, or while setting up the rseq, or it the where to many retires.
-   */
-  THROWS err_t doRseq(size_t maxRetires, rseqCallback rseqFunc, rseqAbortHandlerCallback abortHandler, void *data);
-
   /**
    * @brief Get the current core id
    * 
@@ -61,6 +68,20 @@ extern "C"
    */
   THROWS err_t getCpuId(uint32_t *cpuId);
 
+  /**
+   * @brief if the kernel fills the rseq mm_cid, a concurrency id that is unique among the threads of the process that
+   * are running right now and is smaller then the number of cpus the process can run on(linux 6.3).
+   */
+  bool isRseqMmCidSupported();
+
+  /**
+   * @brief Get the current concurrency id, like the core id it can change right after it is read.
+   *
+   * @param mmCid
+   * @return THROWS if rseq is not registered
+   */
+  THROWS err_t getMmCid(uint32_t *mmCid);
+
 #ifdef __cplusplus
 }
 #endif
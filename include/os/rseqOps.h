@@ -0,0 +1,218 @@
+/**
+ * @file rseqOps.h
+ * @brief restartable sequences for the fast paths, each one is a few instructions of inline asm that start by checking
+ * that the thread is still on the expected cpu(or mm_cid) and end with the one store that commits it.
+ * if the thread is preempted, migrated or gets a signal before that store the kernel moves it to the abort handler and
+ * the operation returns false without changing anything, the caller then takes its slow path.
+ * @note thank you to librseq for the idea.
+ *
+ * there is no setjmp and no callback, the range the kernel checks is only the sequence itself.
+ * only x86_64 has them for now, on anything else every operation returns false.
+ */
+
+#pragma once
+
+#include "os/rseq.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RSEQ_OPS_INLINE __attribute__((always_inline)) inline
+
+typedef enum : uint8_t
+{
+	RSEQ_ID_CPU,
+	RSEQ_ID_MM_CID,
+} rseqIdKind;
+
+#if defined(__x86_64__)
+
+/**
+ * the descriptor of the sequence from label 1 to label 2 with its abort handler at label 4, the descriptor itself is
+ * label 3 and it is set in rseq_cs before label 1.
+ */
+#define RSEQ_OPS_START                                                                                                 \
+	".pushsection __rseq_cs, \"aw\"\n\t"                                                                               \
+	".balign 32\n\t"                                                                                                   \
+	"3:\n\t"                                                                                                           \
+	".long 0x0, 0x0\n\t"                                                                                               \
+	".quad 1f, (2f - 1f), 4f\n\t"                                                                                      \
+	".popsection\n\t"                                                                                                  \
+	"leaq 3b(%%rip), %%rax\n\t"                                                                                        \
+	"movq %%rax, %[rseqCs]\n\t"                                                                                        \
+	"1:\n\t"                                                                                                           \
+	"cmpl %[expectedId], %[currentId]\n\t"                                                                             \
+	"jnz %l[abort]\n\t"
+
+#define RSEQ_OPS_END                                                                                                   \
+	"2:\n\t"                                                                                                           \
+	".pushsection __rseq_failure, \"ax\"\n\t"                                                                          \
+	".long " RSEQ_STR(RSEQ_SIG) "\n\t"                                                                                 \
+	"4:\n\t"                                                                                                           \
+	"jmp %l[abort]\n\t"                                                                                                \
+	".popsection\n\t"
+
+#endif
+
+/**
+ * @brief the id the sequences compare with, -1 if rseq is not registered on this thread so it never matches.
+ * @note mm_cid is 0 before registration, so it is only read once cpu_id says we are registered
+ */
+static RSEQ_OPS_INLINE uint32_t rseqGetId(rseqIdKind kind)
+{
+	volatile struct rseq *area = getRseqArea();
+
+	if ((int32_t)area->cpu_id < 0)
+	{
+		return UINT32_MAX;
+	}
+
+	return kind == RSEQ_ID_MM_CID ? area->mm_cid : area->cpu_id;
+}
+
+static RSEQ_OPS_INLINE volatile uint32_t *rseqGetIdField(rseqIdKind kind)
+{
+	return kind == RSEQ_ID_MM_CID ? &getRseqArea()->mm_cid : &getRseqArea()->cpu_id;
+}
+
+/**
+ * the state word of a rseq stack, the low byte is how many values it has and the bits above it count every push and
+ * pop. a pop adds RSEQ_STACK_POP and a push RSEQ_STACK_PUSH, so the one store that commits an operation also counts it.
+ */
+#define RSEQ_STACK_COUNT_BITS 8
+#define RSEQ_STACK_MAX_COUNT ((1ul << RSEQ_STACK_COUNT_BITS) - 1)
+#define RSEQ_STACK_POP ((1ul << RSEQ_STACK_COUNT_BITS) - 1)
+#define RSEQ_STACK_PUSH ((1ul << RSEQ_STACK_COUNT_BITS) + 1)
+
+static RSEQ_OPS_INLINE uint64_t rseqStackCount(uint64_t state)
+{
+	return state & RSEQ_STACK_MAX_COUNT;
+}
+
+static RSEQ_OPS_INLINE uint64_t rseqStackOperations(uint64_t state)
+{
+	return state >> RSEQ_STACK_COUNT_BITS;
+}
+
+/**
+ * @brief pop the top of a stack that only expectedId changes, the commit is the store of the new state.
+ * @param state the count and the operations of the stack, see RSEQ_STACK_COUNT_BITS
+ * @return false if the stack is empty, rseq is not registered, we are not on expectedId or we were interrupted
+ */
+static RSEQ_OPS_INLINE bool rseqStackPop(uint64_t *state, const intptr_t *slots, uint32_t expectedId, rseqIdKind kind,
+										 intptr_t *value)
+{
+#if defined(__x86_64__)
+	volatile struct rseq *area = getRseqArea();
+
+	if ((int32_t)area->cpu_id < 0)
+	{
+		return false;
+	}
+
+	asm goto(RSEQ_OPS_START
+			 "movq %[state], %%rcx\n\t"
+			 "movzbl %%cl, %%edx\n\t"
+			 "testl %%edx, %%edx\n\t"
+			 "jz %l[abort]\n\t"
+			 "movq -8(%[slots], %%rdx, 8), %%rdx\n\t"
+			 "movq %%rdx, (%[value])\n\t"
+			 "addq %[pop], %%rcx\n\t"
+			 "movq %%rcx, %[state]\n\t" RSEQ_OPS_END
+			 :
+			 : [rseqCs] "m"(area->rseq_cs), [currentId] "m"(*rseqGetIdField(kind)), [expectedId] "r"(expectedId),
+			   [state] "m"(*state), [slots] "r"(slots), [value] "r"(value), [pop] "i"(RSEQ_STACK_POP)
+			 : "memory", "cc", "rax", "rcx", "rdx"
+			 : abort);
+
+	// so a stale descriptor is not read by the kernel on every preemption
+	area->rseq_cs = 0;
+	return true;
+
+abort:
+	area->rseq_cs = 0;
+	return false;
+#else
+	(void)state, (void)slots, (void)expectedId, (void)kind, (void)value;
+	return false;
+#endif
+}
+
+/**
+ * @brief push to a stack that only expectedId changes, the value is written above the top first and the commit is the
+ * store of the new state.
+ * @param state the count and the operations of the stack, capacity is at most RSEQ_STACK_MAX_COUNT
+ * @return false if the stack has capacity values, rseq is not registered, we are not on expectedId or we were
+ * interrupted
+ */
+static RSEQ_OPS_INLINE bool rseqStackPush(uint64_t *state, intptr_t *slots, uint64_t capacity, uint32_t expectedId,
+										  rseqIdKind kind, intptr_t value)
+{
+#if defined(__x86_64__)
+	volatile struct rseq *area = getRseqArea();
+
+	if ((int32_t)area->cpu_id < 0)
+	{
+		return false;
+	}
+
+	asm goto(RSEQ_OPS_START
+			 "movq %[state], %%rcx\n\t"
+			 "movzbl %%cl, %%edx\n\t"
+			 "cmpq %[capacity], %%rdx\n\t"
+			 "jae %l[abort]\n\t"
+			 "movq %[value], (%[slots], %%rdx, 8)\n\t"
+			 "addq %[push], %%rcx\n\t"
+			 "movq %%rcx, %[state]\n\t" RSEQ_OPS_END
+			 :
+			 : [rseqCs] "m"(area->rseq_cs), [currentId] "m"(*rseqGetIdField(kind)), [expectedId] "r"(expectedId),
+			   [state] "m"(*state), [slots] "r"(slots), [capacity] "r"(capacity), [value] "r"(value),
+			   [push] "i"(RSEQ_STACK_PUSH)
+			 : "memory", "cc", "rax", "rcx", "rdx"
+			 : abort);
+
+	area->rseq_cs = 0;
+	return true;
+
+abort:
+	area->rseq_cs = 0;
+	return false;
+#else
+	(void)state, (void)slots, (void)capacity, (void)expectedId, (void)kind, (void)value;
+	return false;
+#endif
+}
+
+/**
+ * @brief add to a counter that only expectedId changes without a lock prefix, the add itself is the commit.
+ * @return false if rseq is not registered, we are not on expectedId or we were interrupted
+ */
+static RSEQ_OPS_INLINE bool rseqAdd(uint64_t *counter, uint32_t expectedId, rseqIdKind kind, uint64_t value)
+{
+#if defined(__x86_64__)
+	volatile struct rseq *area = getRseqArea();
+
+	if ((int32_t)area->cpu_id < 0)
+	{
+		return false;
+	}
+
+	asm goto(RSEQ_OPS_START
+			 "addq %[value], %[counter]\n\t" RSEQ_OPS_END
+			 :
+			 : [rseqCs] "m"(area->rseq_cs), [currentId] "m"(*rseqGetIdField(kind)), [expectedId] "r"(expectedId),
+			   [counter] "m"(*counter), [value] "r"(value)
+			 : "memory", "cc", "rax"
+			 : abort);
+
+	area->rseq_cs = 0;
+	return true;
+
+abort:
+	area->rseq_cs = 0;
+	return false;
+#else
+	(void)counter, (void)expectedId, (void)kind, (void)value;
+	return false;
+#endif
+}
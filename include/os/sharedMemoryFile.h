@@ -2,13 +2,67 @@
 #include "types/err_t.h"
 #include "types/fd_t.h"
 // #include <cstddef>
+#include <stdint.h>
 #include <unistd.h>
 
+// the file is mapped at an address aligned to this, so a block the buddy gives is also aligned to its size
+#ifndef SHARED_MEMORY_FILE_ALIGNMENT
+#define SHARED_MEMORY_FILE_ALIGNMENT (1ul << 30)
+#endif
+
+typedef enum
+{
+	// regular pages
+	SHARED_MEMORY_PAGES_DEFAULT,
+
+	// regular pages with MADV_HUGEPAGE, the kernel backs them with huge pages when it can(needs shmem_enabled=advise)
+	SHARED_MEMORY_PAGES_TRANSPARENT_HUGE,
+
+	// hugetlbfs pages, we fall back to transparent huge pages if there are no huge pages of that size
+	SHARED_MEMORY_PAGES_HUGE_2MB,
+	SHARED_MEMORY_PAGES_HUGE_1GB,
+} sharedMemoryPageMode;
+
+/**
+ * @brief where something is in the file, the offset from its start, a pointer in one process is a handle in every other
+ * process that maps the file. the start of the file is never given to the user so 0 is NULL.
+ */
+typedef uint64_t sharedMemoryHandle;
+
+#define SHARED_MEMORY_NULL_HANDLE 0
+
+#ifndef SHARED_MEMORY_FILE_DEFAULT_PAGE_MODE
+#define SHARED_MEMORY_FILE_DEFAULT_PAGE_MODE SHARED_MEMORY_PAGES_DEFAULT
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+	/**
+	 * @brief choose the pages of the file, has to be called before initSharedMemoryFile.
+	 */
+	THROWS err_t setSharedMemoryFilePageMode(sharedMemoryPageMode mode);
+
+	/**
+	 * @brief back the file with private anonymous memory instead of a memfd, has to be called before
+	 * initSharedMemoryFile. a child after fork gets a copy on write copy of it like of any other memory instead of
+	 * sharing it with the parent, but it can't be sent to another process.
+	 */
+	THROWS err_t setSharedMemoryFilePrivate(bool isPrivate);
+
+	/**
+	 * @brief the mode the file really uses(after any fallback) and its page size, the file size is always a multiple
+	 * of it.
+	 */
+	THROWS err_t getSharedMemoryFilePageMode(sharedMemoryPageMode *mode, size_t *pageSize);
+
+	/**
+	 * @brief reserve pageCount huge pages of hugePageSizeKb in the kernel pool, needs root.
+	 */
+	THROWS err_t initHugeFs(size_t hugePageSizeKb, size_t pageCount);
+
 	THROWS err_t initSharedMemoryFile(size_t maxSize);
 	err_t closeSharedMemoryFile();
 
@@ -18,6 +72,32 @@ extern "C"
 	THROWS err_t getSharedMemoryFileFd(fd_t &fd);
 	THROWS err_t getSharedMemoryFileStartAddr(void **ptr);
 
+	/**
+	 * @brief give the pages of [addr, addr + size) back to the kernel, the range stays mapped and reads as zeros until
+	 * it is written again.
+	 * @note addr and size have to be page aligned, with huge pages only the whole huge pages in the range are released
+	 */
+	THROWS err_t releaseSharedMemoryFileRange(void *addr, size_t size);
+
+	/**
+	 * @brief keep the file size at location instead of in this process, so every process that maps the file sees the
+	 * same size, with copyCurrentSize the size we have now is written there first.
+	 */
+	THROWS err_t setSharedMemoryFileSizeLocation(size_t *location, bool copyCurrentSize);
+
+	/**
+	 * @brief send the file(SCM_RIGHTS) and where it is mapped to another process over a unix socket.
+	 */
+	THROWS err_t sendSharedMemoryFile(int socketFd);
+
+	/**
+	 * @brief receive a file sent with sendSharedMemoryFile and map it, the address is not the one of the sender.
+	 */
+	THROWS err_t attachSharedMemoryFile(int socketFd);
+
+	THROWS err_t getSharedMemoryHandle(const void *ptr, sharedMemoryHandle *handle);
+	THROWS err_t getSharedMemoryPointer(sharedMemoryHandle handle, void **ptr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,11 +11,20 @@ typedef err_t (*allocFuncion)(void **const ptr, const size_t count, const size_t
 typedef err_t (*reallocFuncion)(void **const ptr, const size_t count, const size_t size, allocatorFlags flags,
 								void *data);
 typedef err_t (*deallocFuncion)(void **const ptr, void *data);
+typedef err_t (*sizedDeallocFuncion)(void **const ptr, const size_t size, void *data);
+typedef err_t (*alignedAllocFuncion)(void **const ptr, const size_t count, const size_t size, const size_t alignment,
+									 allocatorFlags flags, void *data);
 
 typedef struct
 {
 	THROWS allocFuncion alloc;
 	THROWS reallocFuncion realloc;
 	THROWS deallocFuncion free;
+
+	// like free when the caller knows the size it asked for, can skip looking up what ptr is
+	THROWS sizedDeallocFuncion freeSized;
+
+	// like alloc but the result is aligned to alignment(a power of 2), it is freed with free
+	THROWS alignedAllocFuncion alignedAlloc;
 	void *data;
 } memoryAllocator;
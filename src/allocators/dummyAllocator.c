@@ -13,7 +13,12 @@ err_t dummyRealloc(void **const ptr, const size_t count, const size_t size, allo
 
 err_t dummyDealloc(void **const ptr, void *sharedAllocatorData);
 
-memoryAllocator dummy = {dummyAlloc, dummyRealloc, dummyDealloc, NULL};
+err_t dummyDeallocSized(void **const ptr, const size_t size, void *sharedAllocatorData);
+
+err_t dummyAlignedAlloc(void **const ptr, const size_t count, const size_t size, const size_t alignment,
+						allocatorFlags flags, void *sharedAllocatorData);
+
+memoryAllocator dummy = {dummyAlloc, dummyRealloc, dummyDealloc, dummyDeallocSized, dummyAlignedAlloc, NULL};
 
 err_t dummyAlloc(void **const ptr, const size_t count, const size_t size, [[maybe_unused]] allocatorFlags flags, [[maybe_unused]] void *sharedAllocatorData)
 {
@@ -53,6 +58,28 @@ cleanup:
 	return err;
 }
 
+err_t dummyDeallocSized(void **const ptr, const size_t size, void *sharedAllocatorData)
+{
+	err_t err = NO_ERRORCODE;
+	QUITE_CHECK(size > 0);
+	QUITE_RETHROW(dummyDealloc(ptr, sharedAllocatorData));
+
+cleanup:
+	return err;
+}
+
+err_t dummyAlignedAlloc(void **const ptr, const size_t count, const size_t size, const size_t alignment,
+						allocatorFlags flags, void *sharedAllocatorData)
+{
+	err_t err = NO_ERRORCODE;
+	QUITE_RETHROW(dummyAlloc(ptr, count, size, flags, sharedAllocatorData));
+	QUITE_CHECK(alignment > 0 && (alignment & (alignment - 1)) == 0);
+	QUITE_CHECK(((size_t)*ptr & (alignment - 1)) == 0);
+
+cleanup:
+	return err;
+}
+
 memoryAllocator *getDummyAllocator()
 {
 	return &dummy;
@@ -0,0 +1,622 @@
+/**
+ * @file mallocReplacement.cpp
+ * @brief replace the libc allocation functions and the c++ new/delete operators with the shared memory pool.
+ * build it as a shared object with REPLACE_MALLOC defined and load it with LD_PRELOAD.
+ *
+ * the pages of the pool are chosen with SHARED_MEMORY_PAGES=thp|2mb|1gb in the environment, and what the caches are
+ * indexed by with SHARED_MEMORY_CACHES=cpu|cid|thread.
+ *
+ * @note the pool is created on the first allocation, everything that is allocated while it is created(or from inside
+ * the allocator itself, like the dlsym calls of rseqInit) comes from a small static arena that is never freed. if the
+ * pool can't be created everything after that goes to the glibc allocator.
+ *
+ * the pool is private memory and not a shared file, a child after fork gets its own copy of the heap like with any
+ * other malloc.
+ */
+
+#ifdef REPLACE_MALLOC
+
+#include "allocators/sharedMemoryPool.h"
+
+#include "defaultTrace.h"
+
+#include "err.h"
+
+#include "memoryUtils/allocatorsConsts.h"
+
+#include "os/sharedMemoryFile.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <dlfcn.h>
+#include <new>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#ifndef BOOTSTRAP_ARENA_SIZE
+#define BOOTSTRAP_ARENA_SIZE (1 << 20)
+#endif
+
+// the minimum alignment malloc has to give
+static constexpr const size_t MALLOC_ALIGNMENT = alignof(max_align_t);
+
+// malloc takes any slab cell without asking for an alignment
+static_assert(defaultPoolConfig::minCellAlignment >= MALLOC_ALIGNMENT, "slab cells are not aligned like malloc");
+
+typedef enum
+{
+	POOL_UNINITIALIZED,
+	POOL_INITIALIZING,
+	POOL_READY,
+	POOL_FAILED,
+} poolState;
+
+static poolState state = POOL_UNINITIALIZED;
+
+extern "C"
+{
+	// the glibc allocator under ours, what everything goes to if the pool failed
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t count, size_t size);
+	void *__libc_memalign(size_t alignment, size_t size);
+	void *__libc_realloc(void *ptr, size_t size);
+	void __libc_free(void *ptr);
+}
+
+// glibc has no __libc_ name for it, so it is looked up when the pool fails
+static size_t (*libcUsableSize)(void *) = NULL;
+
+alignas(MALLOC_ALIGNMENT) static uint8_t bootstrapArena[BOOTSTRAP_ARENA_SIZE];
+static size_t bootstrapArenaUsed = 0;
+
+// set while this thread is inside the pool, an allocation from there(dlsym, new in init) goes to the bootstrap arena
+static thread_local bool isInPool = false;
+
+/**
+ * @brief allocate from the bootstrap arena, the size is kept in the size_t before the pointer so realloc and
+ * malloc_usable_size know it.
+ */
+static void *bootstrapAlignedAlloc(size_t alignment, size_t size)
+{
+	size_t offset = 0;
+	size_t totalSize = 0;
+	uint8_t *ptr = NULL;
+
+	if (__builtin_add_overflow(size, alignment + MALLOC_ALIGNMENT - 1, &totalSize))
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	totalSize &= ~(MALLOC_ALIGNMENT - 1);
+	offset = atomic_fetch_add((_Atomic size_t *)&bootstrapArenaUsed, totalSize);
+	if (offset + totalSize > BOOTSTRAP_ARENA_SIZE)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	// at least MALLOC_ALIGNMENT bytes before ptr for the size
+	ptr = (uint8_t *)(((uintptr_t)&bootstrapArena[offset] + MALLOC_ALIGNMENT + alignment - 1) & ~(alignment - 1));
+	((size_t *)ptr)[-1] = size;
+
+	return ptr;
+}
+
+static void *bootstrapAlloc(size_t size)
+{
+	return bootstrapAlignedAlloc(MALLOC_ALIGNMENT, size);
+}
+
+static size_t bootstrapUsableSize(void *ptr)
+{
+	return ((size_t *)ptr)[-1];
+}
+
+static bool isBootstrapPointer(void *ptr)
+{
+	return (uint8_t *)ptr >= bootstrapArena && (uint8_t *)ptr < bootstrapArena + BOOTSTRAP_ARENA_SIZE;
+}
+
+static void setPageModeFromEnvironment()
+{
+	const char *mode = getenv("SHARED_MEMORY_PAGES");
+
+	if (mode == NULL)
+	{
+		return;
+	}
+
+	if (strcmp(mode, "thp") == 0)
+	{
+		REWARN(setSharedMemoryFilePageMode(SHARED_MEMORY_PAGES_TRANSPARENT_HUGE));
+	}
+	else if (strcmp(mode, "2mb") == 0)
+	{
+		REWARN(setSharedMemoryFilePageMode(SHARED_MEMORY_PAGES_HUGE_2MB));
+	}
+	else if (strcmp(mode, "1gb") == 0)
+	{
+		REWARN(setSharedMemoryFilePageMode(SHARED_MEMORY_PAGES_HUGE_1GB));
+	}
+}
+
+static void setCacheIndexFromEnvironment()
+{
+	const char *index = getenv("SHARED_MEMORY_CACHES");
+
+	if (index == NULL)
+	{
+		return;
+	}
+
+	if (strcmp(index, "cpu") == 0)
+	{
+		REWARN(setSharedMemoryCacheIndex(SHARED_MEMORY_CACHE_PER_CPU));
+	}
+	else if (strcmp(index, "cid") == 0)
+	{
+		REWARN(setSharedMemoryCacheIndex(SHARED_MEMORY_CACHE_PER_CID));
+	}
+	else if (strcmp(index, "thread") == 0)
+	{
+		REWARN(setSharedMemoryCacheIndex(SHARED_MEMORY_CACHE_PER_THREAD));
+	}
+}
+
+/**
+ * @brief create the pool on the first call, only one thread creates it and the rest use the bootstrap arena until it
+ * is ready.
+ */
+static bool isPoolReady()
+{
+	poolState expected = POOL_UNINITIALIZED;
+	err_t err = NO_ERRORCODE;
+
+	if (atomic_load((_Atomic poolState *)&state) == POOL_READY) [[likely]]
+	{
+		return true;
+	}
+
+	if (!atomic_compare_exchange_strong((_Atomic poolState *)&state, &expected, POOL_INITIALIZING))
+	{
+		return false;
+	}
+
+	isInPool = true;
+	setPageModeFromEnvironment();
+	setCacheIndexFromEnvironment();
+	err = setSharedMemoryFilePrivate(true);
+	if (err.errorCode == 0)
+	{
+		err = initSharedMemory();
+	}
+
+	if (err.errorCode == 0)
+	{
+		errno = pthread_atfork(sharedMemoryForkPrepare, sharedMemoryForkRelease, sharedMemoryForkRelease);
+		err.errorCode = errno;
+	}
+
+	if (err.errorCode != 0)
+	{
+		libcUsableSize = (size_t(*)(void *))dlsym(RTLD_NEXT, "malloc_usable_size");
+	}
+
+	isInPool = false;
+
+	atomic_store((_Atomic poolState *)&state, err.errorCode == 0 ? POOL_READY : POOL_FAILED);
+
+	return err.errorCode == 0;
+}
+
+static bool isPoolFailed()
+{
+	return atomic_load((_Atomic poolState *)&state) == POOL_FAILED;
+}
+
+static void *poolAlloc(size_t size, allocatorFlags flags)
+{
+	void *ptr = NULL;
+	err_t err = NO_ERRORCODE;
+
+	if (isInPool || !isPoolReady())
+	{
+		if (isPoolFailed())
+		{
+			return (flags & ALLOCATOR_CLEAR_MEMORY) != 0 ? __libc_calloc(1, size) : __libc_malloc(size);
+		}
+
+		return bootstrapAlloc(size);
+	}
+
+	isInPool = true;
+	err = sharedAlloc(&ptr, 1, MAX(size, 1), flags, NULL);
+	isInPool = false;
+
+	if (err.errorCode != 0)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return ptr;
+}
+
+static void *poolAlignedAlloc(size_t alignment, size_t size)
+{
+	void *res = NULL;
+	err_t err = NO_ERRORCODE;
+
+	if (alignment <= MALLOC_ALIGNMENT)
+	{
+		return poolAlloc(size, 0);
+	}
+
+	if (isInPool || !isPoolReady())
+	{
+		if (isPoolFailed())
+		{
+			return __libc_memalign(alignment, size);
+		}
+
+		return bootstrapAlignedAlloc(alignment, size);
+	}
+
+	isInPool = true;
+	err = sharedAlignedAlloc(&res, 1, MAX(size, 1), alignment, 0, NULL);
+	isInPool = false;
+
+	if (err.errorCode != 0)
+	{
+		errno = err.errorCode == EINVAL ? EINVAL : ENOMEM;
+		return NULL;
+	}
+
+	return res;
+}
+
+/**
+ * @brief a free the pool refuses is of a pointer that is not ours or was already freed, like glibc we stop instead of
+ * leaking it and going on with a heap we can't trust.
+ */
+static void freeFailed(err_t err)
+{
+	static const char message[] = "free(): invalid pointer\n";
+
+	REWARN(err);
+	(void)!write(STDERR_FILENO, message, sizeof(message) - 1);
+	abort();
+}
+
+static void poolFree(void *ptr)
+{
+	err_t err = NO_ERRORCODE;
+
+	if (ptr == NULL || isBootstrapPointer(ptr))
+	{
+		return;
+	}
+
+	// the state never leaves POOL_FAILED, so a pointer that is not from the arena is from glibc
+	if (isPoolFailed())
+	{
+		__libc_free(ptr);
+		return;
+	}
+
+	isInPool = true;
+	err = sharedDealloc(&ptr, NULL);
+	isInPool = false;
+
+	if (err.errorCode != 0)
+	{
+		freeFailed(err);
+	}
+}
+
+static void poolFreeSized(void *ptr, size_t size)
+{
+	err_t err = NO_ERRORCODE;
+
+	if (ptr == NULL || isBootstrapPointer(ptr))
+	{
+		return;
+	}
+
+	if (isPoolFailed())
+	{
+		__libc_free(ptr);
+		return;
+	}
+
+	isInPool = true;
+	err = sharedDeallocSized(&ptr, MAX(size, 1), NULL);
+	isInPool = false;
+
+	if (err.errorCode != 0)
+	{
+		freeFailed(err);
+	}
+}
+
+static size_t poolUsableSize(void *ptr)
+{
+	size_t size = 0;
+	err_t err = NO_ERRORCODE;
+
+	if (ptr == NULL)
+	{
+		return 0;
+	}
+
+	if (isBootstrapPointer(ptr))
+	{
+		return bootstrapUsableSize(ptr);
+	}
+
+	if (isPoolFailed())
+	{
+		return libcUsableSize != NULL ? libcUsableSize(ptr) : 0;
+	}
+
+	isInPool = true;
+	err = sharedGetUsableSize(ptr, &size);
+	isInPool = false;
+
+	return err.errorCode == 0 ? size : 0;
+}
+
+static void *poolRealloc(void *ptr, size_t size)
+{
+	void *newPtr = NULL;
+	err_t err = NO_ERRORCODE;
+
+	if (ptr == NULL)
+	{
+		return poolAlloc(size, 0);
+	}
+
+	if (size == 0)
+	{
+		poolFree(ptr);
+		return NULL;
+	}
+
+	// the arena is never freed, so a bootstrap pointer is always moved, to the pool or to glibc if it failed
+	if (isBootstrapPointer(ptr))
+	{
+		newPtr = poolAlloc(size, 0);
+		if (newPtr != NULL)
+		{
+			memcpy(newPtr, ptr, MIN(bootstrapUsableSize(ptr), size));
+		}
+
+		return newPtr;
+	}
+
+	if (isPoolFailed())
+	{
+		return __libc_realloc(ptr, size);
+	}
+
+	// the pool keeps a cell that still fits or moves it, and knows how much of a large block is still there to copy
+	isInPool = true;
+	err = sharedRealloc(&ptr, 1, size, 0, NULL);
+	isInPool = false;
+
+	if (err.errorCode != 0)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return ptr;
+}
+
+static void *newAlloc(size_t size, size_t alignment, bool isNoThrow)
+{
+	void *ptr = NULL;
+	std::new_handler handler = NULL;
+
+	while ((ptr = poolAlignedAlloc(alignment, size)) == NULL)
+	{
+		handler = std::get_new_handler();
+		if (handler == NULL)
+		{
+			if (isNoThrow)
+			{
+				return NULL;
+			}
+
+			throw std::bad_alloc();
+		}
+
+		handler();
+	}
+
+	return ptr;
+}
+
+extern "C"
+{
+	void *malloc(size_t size)
+	{
+		return poolAlloc(size, 0);
+	}
+
+	void free(void *ptr)
+	{
+		poolFree(ptr);
+	}
+
+	void *calloc(size_t count, size_t size)
+	{
+		size_t totalSize = 0;
+
+		if (__builtin_mul_overflow(count, size, &totalSize))
+		{
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		return poolAlloc(totalSize, ALLOCATOR_CLEAR_MEMORY);
+	}
+
+	void *realloc(void *ptr, size_t size)
+	{
+		return poolRealloc(ptr, size);
+	}
+
+	void *memalign(size_t alignment, size_t size)
+	{
+		if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+		{
+			errno = EINVAL;
+			return NULL;
+		}
+
+		return poolAlignedAlloc(alignment, size);
+	}
+
+	void *aligned_alloc(size_t alignment, size_t size)
+	{
+		return memalign(alignment, size);
+	}
+
+	int posix_memalign(void **memptr, size_t alignment, size_t size)
+	{
+		void *ptr = NULL;
+
+		if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+		{
+			return EINVAL;
+		}
+
+		ptr = poolAlignedAlloc(alignment, size);
+		if (ptr == NULL)
+		{
+			return ENOMEM;
+		}
+
+		*memptr = ptr;
+		return 0;
+	}
+
+	void *valloc(size_t size)
+	{
+		return poolAlignedAlloc(sysconf(_SC_PAGESIZE), size);
+	}
+
+	size_t malloc_usable_size(void *ptr)
+	{
+		return poolUsableSize(ptr);
+	}
+}
+
+void *operator new(size_t size)
+{
+	return newAlloc(size, MALLOC_ALIGNMENT, false);
+}
+
+void *operator new[](size_t size)
+{
+	return newAlloc(size, MALLOC_ALIGNMENT, false);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return newAlloc(size, MALLOC_ALIGNMENT, true);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return newAlloc(size, MALLOC_ALIGNMENT, true);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+	return newAlloc(size, (size_t)alignment, false);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+	return newAlloc(size, (size_t)alignment, false);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return newAlloc(size, (size_t)alignment, true);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return newAlloc(size, (size_t)alignment, true);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	poolFree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	poolFree(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+	poolFree(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+	poolFree(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+	poolFreeSized(ptr, size);
+}
+
+void operator delete[](void *ptr, size_t size) noexcept
+{
+	poolFreeSized(ptr, size);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] std::align_val_t alignment) noexcept
+{
+	poolFree(ptr);
+}
+
+void operator delete[](void *ptr, [[maybe_unused]] std::align_val_t alignment) noexcept
+{
+	poolFree(ptr);
+}
+
+void operator delete(void *ptr, size_t size, [[maybe_unused]] std::align_val_t alignment) noexcept
+{
+	poolFreeSized(ptr, size);
+}
+
+void operator delete[](void *ptr, size_t size, [[maybe_unused]] std::align_val_t alignment) noexcept
+{
+	poolFreeSized(ptr, size);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	poolFree(ptr);
+}
+
+void operator delete[](void *ptr, [[maybe_unused]] std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	poolFree(ptr);
+}
+
+#endif
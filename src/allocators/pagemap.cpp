@@ -0,0 +1,113 @@
+#include "allocators/pagemap.h"
+
+#include "defaultTrace.h"
+
+#include "err.h"
+
+THROWS err_t initPagemap(pagemap *map, pagemapEntry *entries, void *base, size_t rangeExponent, size_t pageExponent)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(map != NULL);
+	QUITE_CHECK(entries != NULL);
+	QUITE_CHECK(base != NULL);
+	QUITE_CHECK(rangeExponent > pageExponent);
+
+	// pagemapGetPageStart masks the address, so the pages have to be aligned and not just offset from base
+	QUITE_CHECK(((uintptr_t)base & ((1ul << pageExponent) - 1)) == 0);
+
+	map->pageCount = 1ul << (rangeExponent - pageExponent);
+	map->entries = entries;
+	map->base = (uintptr_t)base;
+	map->pageExponent = pageExponent;
+
+cleanup:
+	return err;
+}
+
+err_t closePagemap(pagemap *map)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(map != NULL);
+	QUITE_CHECK(map->entries != NULL);
+
+	// the table belongs to the caller
+	map->entries = NULL;
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief the entry of the page that starts at block, block has to be the start of a page in the pool.
+ */
+static pagemapEntry *getBlockEntry(pagemap *map, void *block)
+{
+	if (map == NULL || map->entries == NULL || pagemapGetPageStart(map, block) != block)
+	{
+		return NULL;
+	}
+
+	return (pagemapEntry *)pagemapGet(map, block);
+}
+
+THROWS err_t pagemapSetSlab(pagemap *map, void *slabStart, uint8_t sizeClass)
+{
+	err_t err = NO_ERRORCODE;
+	pagemapEntry *entry = getBlockEntry(map, slabStart);
+
+	QUITE_CHECK(entry != NULL);
+
+	entry->sizeClass = sizeClass;
+	entry->blockExponent = 0;
+	entry->liveExponent = 0;
+	entry->kind = PAGEMAP_SLAB;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t pagemapSetLargeBlock(pagemap *map, void *block, uint8_t blockExponent)
+{
+	err_t err = NO_ERRORCODE;
+	pagemapEntry *entry = getBlockEntry(map, block);
+
+	QUITE_CHECK(entry != NULL);
+	QUITE_CHECK(blockExponent >= map->pageExponent);
+
+	entry->sizeClass = 0;
+	entry->blockExponent = blockExponent;
+	entry->liveExponent = blockExponent;
+	entry->kind = PAGEMAP_LARGE_BLOCK;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t pagemapSetLargeBlockLiveSize(pagemap *map, void *block, uint8_t liveExponent)
+{
+	err_t err = NO_ERRORCODE;
+	pagemapEntry *entry = getBlockEntry(map, block);
+
+	QUITE_CHECK(entry != NULL && entry->kind == PAGEMAP_LARGE_BLOCK);
+	QUITE_CHECK(liveExponent <= entry->blockExponent);
+
+	entry->liveExponent = liveExponent;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t pagemapClear(pagemap *map, void *block)
+{
+	err_t err = NO_ERRORCODE;
+	pagemapEntry *entry = getBlockEntry(map, block);
+
+	QUITE_CHECK(entry != NULL);
+
+	entry->kind = PAGEMAP_UNUSED;
+
+cleanup:
+	return err;
+}
@@ -11,46 +11,127 @@
 #include "types/memoryAllocator.h"
 #include "types/memoryMapInfo.h"
 
+#include "allocators/pagemap.h"
 #include "allocators/unsafeAllocator.h"
 
 #include "memoryUtils/allocatorsConsts.h"
 #include "memoryUtils/allocatorsUtilFunctions.h"
+#include "memoryUtils/offsetPtr.h"
 
+#include "os/futexLock.h"
+#include "os/numa.h"
 #include "os/rseq.h"
+#include "os/rseqOps.h"
 
 #include <alloca.h>
 #include <cerrno>
 #include <cstddef>
 #include <cstdint>
 #include <math.h>
+#include <pthread.h>
 #include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/param.h>
 
-#include <sys/ipc.h>
-#include <sys/sem.h>
-
-union semun {
-	int val;
-	struct semid_ds *buf;
-	ushort *array;
-};
-
 typedef struct
 {
 	void **const data;
+	size_t count;
+	size_t allocatedCount;
 	uint32_t sizeClass;
-	allocatorFlags flags;
 	uint32_t coreId;
-} rseqAllocCall;
+} allocBatchCall;
+
+/**
+ * @brief a per thread cache slot, users is the number of threads that use its caches and the lock is taken around
+ * every use so the slot can be shared once there are more threads then slots.
+ */
+typedef struct
+{
+	futexLock lock;
+	uint32_t users;
+} threadCacheSlot;
 
 static const size_t freeListSize = GET_BUDDY_MAX_ELEMENT_COUNT(MAX_RANGE_EXPONENT, MIN_BUDDY_BLOCK_SIZE_EXPONENT);
-static const memoryAllocator sharedAllocator = {&sharedAlloc, &sharedRealloc, &sharedDealloc, NULL};
+static const memoryAllocator sharedAllocator = {&sharedAlloc,		   &sharedRealloc,		&sharedDealloc,
+												&sharedDeallocSized, &sharedAlignedAlloc, NULL};
+
+// the pointers of this process to the metadata in the pool, every pointer in the pool itself is an offsetPtr so a
+// process can map it anywhere
+// the caches of each core or concurrency id, a slot stays NULL until the first allocation with that id creates them
+static atomicOffsetPtr<slabCache> *coreCaches = NULL;
+static long coreCachesCount = 0;
+static sharedMemoryCacheIndex cacheIndex = SHARED_MEMORY_DEFAULT_CACHE_INDEX;
 
-static memoryAllocator **coreCaches = NULL;
+// one for each size class on each numa node, shared by all of the cores of the node
+static transferCache *transferCaches = NULL;
+static uint32_t numaNodeCount = 1;
 
-int semid = 0;
+// the numa node of each cpu
+static uint32_t *cpuNodes = NULL;
+static long cpuCount = 0;
+
+// only with per thread caches, one for each slot of coreCaches. the key gives the slot of a thread back when it exits
+static threadCacheSlot *threadSlots = NULL;
+static pthread_key_t threadSlotKey;
+static bool isThreadSlotKeyCreated = false;
+
+// where the next thread starts looking for a free slot, only a hint so it is per process
+static uint32_t nextThreadSlot = 0;
+
+// what every page of the pool(the smallest buddy block) is, a slab or the start of a large block
+static pagemap pages = {NULL, 0, 0, 0};
+
+// guard g_buddy, a futex lock so it costs no syscall unless another thread is already holding it, it is in the pool
+// header so it guards the buddy for every process that maps the pool
+static futexLock *pageHeapLock = NULL;
+
+// "SHMEMPOL", written last so a process that attaches to a pool that is not ready yet fails
+#define SHARED_MEMORY_POOL_MAGIC 0x53484d454d504f4cul
+
+/**
+ * @brief the first block of the pool, at the start of the file, everything another process needs to find the allocator
+ * in it.
+ */
+typedef struct
+{
+	uint64_t magic;
+	futexLock pageHeapLock;
+	size_t fileSize;
+	offsetPtr<buddyAllocator> buddy;
+	offsetPtr<atomicOffsetPtr<slabCache>> coreCaches;
+	long coreCachesCount;
+	sharedMemoryCacheIndex cacheIndex;
+	offsetPtr<transferCache> transferCaches;
+	uint32_t numaNodeCount;
+	offsetPtr<uint32_t> cpuNodes;
+	long cpuCount;
+	offsetPtr<threadCacheSlot> threadSlots;
+	offsetPtr<pagemapEntry> pagemapEntries;
+
+	// the stats of the whole pool, here so every process that maps it counts in the same place and a tool that
+	// attaches reads them live. pageHeapBytes is under the page heap lock
+	uint64_t pageHeapBytes;
+} sharedMemoryPoolHeader;
+
+static sharedMemoryPoolHeader *poolHeader = NULL;
+
+// only the process that created the pool closes the buddy, the rest only unmap it
+static bool isPoolOwner = false;
+
+static sharedMemoryRefillStats refillStats = {0, 0};
+static sharedMemoryNumaStats numaStats = {};
+static sharedMemoryRefillConfig refillerConfig = SHARED_MEMORY_REFILL_DEFAULT_CONFIG;
+static pthread_t refillerThread;
+static bool isRefillerRunning = false;
+
+static sharedMemoryScavengeConfig scavengerConfig = SHARED_MEMORY_SCAVENGE_DEFAULT_CONFIG;
+static pthread_t scavengerThread;
+static bool isScavengerRunning = false;
 
 /**
  * @brief in order to use the buddy allocator, we need a buddy allocator, so first we put it on the stack and then we
@@ -62,8 +143,6 @@ int semid = 0;
 THROWS static err_t initBuddyAllocatorOnStack(buddyAllocator *resBuddyAllocator)
 {
 	err_t err = NO_ERRORCODE;
-	union semun arg;
-	struct sembuf sb;
 
 	resBuddyAllocator->memorySource = {nullptr, getSharedMemoryFileSize, setSharedMemoryFileSize};
 	resBuddyAllocator->poolSizeExponent = MAX_RANGE_EXPONENT;
@@ -73,24 +152,58 @@ THROWS static err_t initBuddyAllocatorOnStack(buddyAllocator *resBuddyAllocator)
 	QUITE_RETHROW(getSharedMemoryFileStartAddr(&resBuddyAllocator->memorySource.startAddr));
 	QUITE_RETHROW(initBuddyAllocator(resBuddyAllocator));
 
-	semid = semget(0, 1, IPC_CREAT | IPC_EXCL | 0666);
+cleanup:
+	return err;
+}
+
+static transferCache *getTransferCache(uint32_t node, uint32_t sizeClass)
+{
+	return &transferCaches[node * SIZE_CLASSES_COUNT + sizeClass];
+}
 
-	sb.sem_op = 1;
-	sb.sem_flg = 0;
-	arg.val = 1;
+/**
+ * @brief the numa node of a core cache, from the transfer cache it was given.
+ */
+static uint32_t getCacheNode(const slabCache *cache)
+{
+	return (uint32_t)((cache->centralCache.get() - transferCaches) / SIZE_CLASSES_COUNT);
+}
 
-	for (sb.sem_num = 0; sb.sem_num < 1; sb.sem_num++)
+/**
+ * @brief if this thread is registered to rseq or can be, a thread of the same process gets the same answer.
+ */
+static bool isRseqAvailable()
+{
+	if ((int32_t)getRseqArea()->cpu_id >= 0)
 	{
-		/* do a semop() to "free" the semaphores. */
-		/* this sets the sem_otime field, as needed below. */
-		if (semop(semid, &sb, 1) == -1)
-		{
-			int e = errno;
-			semctl(semid, 0, IPC_RMID); /* clean up */
-			QUITE_CHECK(e == 0);
-		}
+		return true;
+	}
+
+	return rseqInit().errorCode == 0;
+}
+
+/**
+ * @brief give the slot of a thread back when it exits, the cells in its fast cells stay for the next thread.
+ */
+static void releaseThreadSlot(void *slot)
+{
+	atomic_fetch_sub((_Atomic uint32_t *)&((threadCacheSlot *)slot)->users, 1);
+	currentThreadCacheId = NO_SLAB_CACHE_OWNER;
+}
+
+THROWS static err_t createThreadSlotKey()
+{
+	err_t err = NO_ERRORCODE;
+
+	if (cacheIndex != SHARED_MEMORY_CACHE_PER_THREAD || isThreadSlotKeyCreated)
+	{
+		goto cleanup;
 	}
 
+	errno = pthread_key_create(&threadSlotKey, releaseThreadSlot);
+	QUITE_CHECK(errno == 0);
+	isThreadSlotKeyCreated = true;
+
 cleanup:
 	return err;
 }
@@ -99,51 +212,100 @@ cleanup:
  * @brief we want each core to alloc from a memory that is garnted to be thread safe
  * so each cpu core can only allocate from it own buffer and there is a process that fill them up
  * @note thank you to tcmalloc for the idea.
+ *
+ * only the slots are made here, the caches of a slot are created the first time a thread allocates with its id so a
+ * cpu(or concurrency id) that is never used costs 8 bytes.
+ * without rseq there is no core to own a cache, so the slots are given to threads instead.
  */
 THROWS static err_t initCoreCaches(buddyAllocator *buddyOnStack)
 {
 	err_t err = NO_ERRORCODE;
-	long coreCount = sysconf(_SC_NPROCESSORS_ONLN);
-	uint32_t coreId = 0;
-	slab *tempSlab = NULL;
-	memoryAllocator tempCaches[256][sizeof(allocationCachesSizes) / sizeof(size_t)];
-	size_t tempSizeClass = 0;
+	size_t threadSlotsSize = 0;
+
+	cpuCount = sysconf(_SC_NPROCESSORS_CONF);
 
 	QUITE_CHECK(buddyOnStack != nullptr);
+	QUITE_CHECK(cpuCount > 0);
+	coreCachesCount = cpuCount;
+	QUITE_RETHROW(getNumaNodeCount(&numaNodeCount));
 
-	getcpu(&coreId, NULL);
+	if (cacheIndex != SHARED_MEMORY_CACHE_PER_THREAD && !isRseqAvailable())
+	{
+		cacheIndex = SHARED_MEMORY_CACHE_PER_THREAD;
+	}
 
-	for (int i = 0; i < coreCount; i++)
+	if (cacheIndex == SHARED_MEMORY_CACHE_PER_CID && !isRseqMmCidSupported())
 	{
-		for (size_t j = 0; j < sizeof(allocationCachesSizes) / sizeof(size_t); j++)
-		{
-			QUITE_RETHROW(buddyAlloc(buddyOnStack, (void **)&tempSlab, SLAB_SIZE));
-			QUITE_RETHROW(createUnsafeAllocator(&tempCaches[i][j], tempSlab, allocationCachesSizes[j]));
-		}
+		cacheIndex = SHARED_MEMORY_CACHE_PER_CPU;
 	}
 
-	// we want the caches to be saved on the shared memory in an efficent way
-	tempSizeClass = getSizeClass(sizeof(memoryAllocator *) * coreCount);
-	CHECK_TRACE(tempSizeClass != SIZE_MAX, "there is no allocator sizecall  big enght to allocate {}",
-				sizeof(memoryAllocator *) * coreCount);
+	if (cacheIndex == SHARED_MEMORY_CACHE_PER_THREAD)
+	{
+		coreCachesCount = SHARED_MEMORY_MAX_THREAD_CACHES;
+		threadSlotsSize = coreCachesCount * sizeof(threadCacheSlot);
+	}
 
-	QUITE_RETHROW(tempCaches[0][tempSizeClass].alloc((void **)&coreCaches, coreCount, sizeof(memoryAllocator *), 0,
-													 tempCaches[0][tempSizeClass].data));
+	// we want the metadata to be saved on the shared memory in one block, the transfer caches of every node, the cache
+	// slots, the node of each cpu and the thread slots. a cid is never bigger then the cpu count so it has the same
+	// slots.
+	QUITE_RETHROW(buddyAlloc(buddyOnStack, (void **)&transferCaches,
+							 numaNodeCount * SIZE_CLASSES_COUNT * sizeof(transferCache) +
+								 coreCachesCount * sizeof(atomicOffsetPtr<slabCache>) + cpuCount * sizeof(uint32_t) +
+								 threadSlotsSize));
+	coreCaches = (atomicOffsetPtr<slabCache> *)&transferCaches[numaNodeCount * SIZE_CLASSES_COUNT];
+	cpuNodes = (uint32_t *)&coreCaches[coreCachesCount];
+	threadSlots = threadSlotsSize > 0 ? (threadCacheSlot *)&cpuNodes[cpuCount] : NULL;
+
+	for (size_t j = 0; j < numaNodeCount * SIZE_CLASSES_COUNT; j++)
+	{
+		QUITE_RETHROW(initTransferCache(&transferCaches[j]));
+	}
 
-	tempSizeClass = getSizeClass(sizeof(memoryAllocator) * (sizeof(allocationCachesSizes) / sizeof(size_t)));
-	CHECK_TRACE(tempSizeClass != SIZE_MAX, "there is no allocator sizecall  big enght to allocate {}",
-				sizeof(memoryAllocator *) * coreCount);
+	for (long i = 0; i < cpuCount; i++)
+	{
+		QUITE_RETHROW(getCpuNumaNode(i, numaNodeCount, &cpuNodes[i]));
+	}
 
-	for (int i = 0; i < coreCount; i++)
+	for (long i = 0; i < coreCachesCount; i++)
 	{
-		coreCaches[i] = NULL;
-		RETHROW(tempCaches[i][tempSizeClass].alloc((void **)&coreCaches[i],
-												   sizeof(allocationCachesSizes) / sizeof(size_t),
-												   sizeof(memoryAllocator), 0, tempCaches[i][tempSizeClass].data));
-		memcpy(coreCaches[i], &tempCaches[i],
-			   (sizeof(allocationCachesSizes) / sizeof(size_t)) * sizeof(memoryAllocator));
+		coreCaches[i].store(NULL);
+		if (threadSlots != NULL)
+		{
+			QUITE_RETHROW(initFutexLock(&threadSlots[i].lock));
+			threadSlots[i].users = 0;
+		}
 	}
 
+	QUITE_RETHROW(createThreadSlotKey());
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief the pool header has to be the first block so another process finds it at the start of the file, the pagemap
+ * table comes right after it.
+ */
+THROWS static err_t initPoolHeader(buddyAllocator *buddyOnStack)
+{
+	err_t err = NO_ERRORCODE;
+	pagemapEntry *entries = NULL;
+
+	QUITE_RETHROW(buddyAlloc(buddyOnStack, (void **)&poolHeader, sizeof(sharedMemoryPoolHeader)));
+	QUITE_CHECK((void *)poolHeader == buddyOnStack->memorySource.startAddr);
+
+	QUITE_RETHROW(initFutexLock(&poolHeader->pageHeapLock));
+	pageHeapLock = &poolHeader->pageHeapLock;
+	poolHeader->pageHeapBytes = 0;
+	QUITE_RETHROW(setSharedMemoryFileSizeLocation(&poolHeader->fileSize, true));
+
+	// a new block of the file reads as zeros, that is PAGEMAP_UNUSED
+	QUITE_RETHROW(buddyAlloc(buddyOnStack, (void **)&entries,
+							 pagemapGetTableSize(MAX_RANGE_EXPONENT, MIN_BUDDY_BLOCK_SIZE_EXPONENT)));
+	QUITE_RETHROW(initPagemap(&pages, entries, buddyOnStack->memorySource.startAddr, MAX_RANGE_EXPONENT,
+							  MIN_BUDDY_BLOCK_SIZE_EXPONENT));
+	poolHeader->pagemapEntries = entries;
+
 cleanup:
 	return err;
 }
@@ -160,209 +322,1727 @@ THROWS err_t initSharedMemory()
 
 	QUITE_RETHROW(initBuddyAllocatorOnStack(buddy));
 
+	QUITE_RETHROW(initPoolHeader(buddy));
+
 	QUITE_RETHROW(initCoreCaches(buddy));
 
 	QUITE_RETHROW(moveBuddyFromStackToFinalAllocator(&g_buddy, buddy));
 
+	poolHeader->buddy = g_buddy;
+	poolHeader->coreCaches = coreCaches;
+	poolHeader->coreCachesCount = coreCachesCount;
+	poolHeader->cacheIndex = cacheIndex;
+	poolHeader->transferCaches = transferCaches;
+	poolHeader->numaNodeCount = numaNodeCount;
+	poolHeader->cpuNodes = cpuNodes;
+	poolHeader->cpuCount = cpuCount;
+	poolHeader->threadSlots = threadSlots;
+	atomic_store((_Atomic uint64_t *)&poolHeader->magic, SHARED_MEMORY_POOL_MAGIC);
+	isPoolOwner = true;
+
 cleanup:
 	return err;
 }
 
-err_t closeSharedMemory()
+THROWS err_t setSharedMemoryCacheIndex(sharedMemoryCacheIndex index)
 {
 	err_t err = NO_ERRORCODE;
 
-	QUITE_RETHROW(closeBuddyAllocator(g_buddy));
-	g_buddy = nullptr;
+	QUITE_CHECK(poolHeader == NULL);
+	QUITE_CHECK(index == SHARED_MEMORY_CACHE_PER_CPU || index == SHARED_MEMORY_CACHE_PER_CID ||
+				index == SHARED_MEMORY_CACHE_PER_THREAD);
+
+	cacheIndex = index;
 
 cleanup:
-	REWARN(closeSharedMemoryFile());
+	return err;
+}
+
+THROWS err_t getSharedMemoryCacheIndex(sharedMemoryCacheIndex *index)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(index != NULL);
+
+	*index = cacheIndex;
 
+cleanup:
 	return err;
 }
 
-THROWS static err_t handleSlabAllocError(memoryAllocator *slabAllocator, [[maybe_unused]] void **const data,
-										 [[maybe_unused]] size_t size, [[maybe_unused]] allocatorFlags flags)
+THROWS err_t sendSharedMemory(int socketFd)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(poolHeader != NULL);
+	QUITE_RETHROW(sendSharedMemoryFile(socketFd));
+
+cleanup:
+	return err;
+}
+
+THROWS err_t attachSharedMemory(int socketFd)
 {
 	err_t err = NO_ERRORCODE;
-	slab *tempSlab;
+	sharedMemoryPoolHeader *header = NULL;
+
+	QUITE_CHECK(g_buddy == nullptr);
+
+	QUITE_RETHROW(attachSharedMemoryFile(socketFd));
+	QUITE_RETHROW(getSharedMemoryFileStartAddr((void **)&header));
+	QUITE_CHECK(atomic_load((_Atomic uint64_t *)&header->magic) == SHARED_MEMORY_POOL_MAGIC);
+
+	// per core caches take the core from rseq, so both processes have to see the same cores and both need rseq. a
+	// mm_cid is per process, two processes would use the same caches at the same time. the thread slots are taken in
+	// the pool so they work from any process
+	QUITE_CHECK(header->cacheIndex != SHARED_MEMORY_CACHE_PER_CID);
+	if (header->cacheIndex == SHARED_MEMORY_CACHE_PER_CPU)
+	{
+		QUITE_CHECK(isRseqAvailable());
+		QUITE_CHECK(header->coreCachesCount == sysconf(_SC_NPROCESSORS_CONF));
+	}
+	else
+	{
+		QUITE_CHECK(header->threadSlots.get() != NULL);
+	}
+
+	QUITE_CHECK(header->numaNodeCount > 0 && header->numaNodeCount <= NUMA_MAX_NODES);
 
-	struct sembuf sb;
-	sb.sem_num = 0;
-	sb.sem_op = -1; /* set to allocate resource */
-	sb.sem_flg = SEM_UNDO;
+	QUITE_RETHROW(setSharedMemoryFileSizeLocation(&header->fileSize, false));
 
-	QUITE_CHECK(semop(semid, &sb, 1) == 0);
+	QUITE_RETHROW(initPagemap(&pages, header->pagemapEntries, header, MAX_RANGE_EXPONENT, MIN_BUDDY_BLOCK_SIZE_EXPONENT));
 
-	QUITE_RETHROW(buddyAlloc(g_buddy, (void **)&tempSlab, SLAB_SIZE));
+	poolHeader = header;
+	pageHeapLock = &header->pageHeapLock;
+	coreCaches = header->coreCaches;
+	coreCachesCount = header->coreCachesCount;
+	cacheIndex = header->cacheIndex;
+	transferCaches = header->transferCaches;
+	numaNodeCount = header->numaNodeCount;
+	cpuNodes = header->cpuNodes;
+	cpuCount = header->cpuCount;
+	threadSlots = header->threadSlots;
+	g_buddy = header->buddy;
 
-	QUITE_RETHROW(appendSlab(slabAllocator, tempSlab));
+	QUITE_RETHROW(createThreadSlotKey());
 
 cleanup:
-	sb.sem_op = 1;
-	WARN(semop(semid, &sb, 1) == 0);
+	if (err.errorCode != 0 && header != NULL)
+	{
+		REWARN(closeSharedMemoryFile());
+	}
 
 	return err;
 }
 
-USED_IN_RSEQ err_t allocRseq(void *rseqAllocData)
+err_t closeSharedMemory()
 {
 	err_t err = NO_ERRORCODE;
-	rseqAllocCall *rseqCall = (rseqAllocCall *)rseqAllocData;
 
-	size_t size = 0;
-	memoryAllocator *slabAllocator = NULL;
-	isInRseq  = true;
+	REWARN(stopSharedMemoryRefiller());
+	REWARN(stopSharedMemoryScavenger());
+
+	if (isPoolOwner)
+	{
+		QUITE_RETHROW(closeBuddyAllocator(g_buddy));
+	}
 
-	QUITE_RETHROW(getCpuId(&rseqCall->coreId));
+	g_buddy = nullptr;
+	poolHeader = NULL;
+	pageHeapLock = NULL;
+	isPoolOwner = false;
 
-	slabAllocator = &coreCaches[rseqCall->coreId][rseqCall->sizeClass];
-	size = allocationCachesSizes[rseqCall->sizeClass];
-	QUITE_RETHROW(slabAllocator->alloc(rseqCall->data, 1, size, rseqCall->flags, slabAllocator->data));
+	if (pages.entries != NULL)
+	{
+		REWARN(closePagemap(&pages));
+	}
 
 cleanup:
+	REWARN(closeSharedMemoryFile());
+
 	return err;
 }
 
-err_t abortRseqAlloc([[maybe_unused]] bool *shouldRetry, void *rseqAllocData)
+/**
+ * @brief call lockFunc on the lock of every slab cache that was created.
+ */
+static void forEachSlabCacheLock(err_t (*lockFunc)(futexLock *lock))
 {
+	slabCache *caches = NULL;
 
-	err_t err = NO_ERRORCODE;
-	rseqAllocCall *rseqCall = (rseqAllocCall *)rseqAllocData;
+	for (long i = 0; coreCaches != NULL && i < coreCachesCount; i++)
+	{
+		caches = coreCaches[i].load();
+		for (size_t j = 0; caches != NULL && j < SIZE_CLASSES_COUNT; j++)
+		{
+			REWARN(lockFunc(&caches[j].lock));
+		}
+	}
+}
+
+void sharedMemoryForkPrepare()
+{
+	// a thread cache takes the page heap lock and the slab cache locks while it holds its own lock, so they are taken
+	// in the same order. no one waits on the page heap lock with a slab cache lock, and while we hold it no caches are
+	// created so we get the locks of all of them
+	for (long i = 0; threadSlots != NULL && i < coreCachesCount; i++)
+	{
+		REWARN(futexLockAcquire(&threadSlots[i].lock));
+	}
+
+	if (pageHeapLock != NULL)
+	{
+		REWARN(futexLockAcquire(pageHeapLock));
+	}
+
+	forEachSlabCacheLock(futexLockAcquire);
+}
 
-	if (*rseqCall->data != NULL)
+void sharedMemoryForkRelease()
+{
+	forEachSlabCacheLock(futexLockRelease);
+
+	if (pageHeapLock != NULL)
+	{
+		REWARN(futexLockRelease(pageHeapLock));
+	}
+
+	for (long i = 0; threadSlots != NULL && i < coreCachesCount; i++)
 	{
-		*shouldRetry = false;
+		REWARN(futexLockRelease(&threadSlots[i].lock));
 	}
+}
+
+/**
+ * @brief take the page heap lock, the buddy keeps the address of the pool and callbacks into the file to grow it and
+ * they are the ones of the process that wrote them last, so while we hold the lock they are pointed at ours.
+ */
+THROWS static err_t lockPageHeap()
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_RETHROW(futexLockAcquire(pageHeapLock));
+	g_buddy->memorySource.startAddr = poolHeader;
+	g_buddy->memorySource.getSize = getSharedMemoryFileSize;
+	g_buddy->memorySource.setSize = setSharedMemoryFileSize;
 
+cleanup:
 	return err;
 }
 
-THROWS static err_t handleSlabAlloc(void **const data, uint32_t sizeClass, [[maybe_unused]] allocatorFlags flags)
+/**
+ * @brief the exponent of the buddy block an allocation of size gets, a size above the whole range gets the range.
+ */
+static uint8_t getBuddyBlockExponent(size_t size)
+{
+	uint8_t exponent = MIN_BUDDY_BLOCK_SIZE_EXPONENT;
+
+	while (exponent < MAX_RANGE_EXPONENT && (1ul << exponent) < size)
+	{
+		exponent++;
+	}
+
+	return exponent;
+}
+
+THROWS static err_t pageHeapAlloc(void **const data, size_t size)
 {
 	err_t err = NO_ERRORCODE;
-	rseqAllocCall rseqCall = {data, sizeClass, flags, UINT32_MAX};
 
-	do
+	QUITE_RETHROW(lockPageHeap());
+	err = buddyAlloc(g_buddy, data, size);
+	if (err.errorCode == 0)
 	{
-		RETHROW_BASE_NOTRACE(
-			doRseq(10000, &allocRseq, &abortRseqAlloc, (void *)&rseqCall),
-			if (err.errorCode == ENOMEM) {
-				err = NO_ERRORCODE;
-				err = handleSlabAllocError(&coreCaches[rseqCall.coreId][sizeClass], data,
-										   allocationCachesSizes[rseqCall.sizeClass], flags);
-			} else { goto cleanup; });
-	} while (*data == NULL);
+		poolHeader->pageHeapBytes += 1ul << getBuddyBlockExponent(size);
+	}
+
+	REWARN(futexLockRelease(pageHeapLock));
+	QUITE_RETHROW(err);
 
 cleanup:
 	return err;
 }
 
-THROWS err_t sharedAlloc(void **const data, const size_t count, const size_t size, allocatorFlags flags,
-						 [[maybe_unused]] void *sharedAllocatorData)
+THROWS static err_t pageHeapFree(void **const data, size_t size)
 {
 	err_t err = NO_ERRORCODE;
-	uint32_t sizeClass = UINT32_MAX;
-	struct sembuf sb;
-
-	QUITE_CHECK(data != NULL);
-	QUITE_CHECK(*data == NULL);
-	QUITE_CHECK(size > 0);
 
-	sizeClass = getSizeClass(size * count);
-	if (sizeClass == UINT32_MAX)
+	QUITE_RETHROW(lockPageHeap());
+	err = buddyFree(g_buddy, data);
+	if (err.errorCode == 0)
 	{
-		sb.sem_num = 0;
-		sb.sem_op = -1; /* set to allocate resource */
-		sb.sem_flg = SEM_UNDO;
-		QUITE_CHECK(semop(semid, &sb, 1) == 0);
-		err = buddyAlloc(g_buddy, data, count * size);
+		poolHeader->pageHeapBytes -= 1ul << getBuddyBlockExponent(size);
+	}
 
-		QUITE_RETHROW(err);
+	REWARN(futexLockRelease(pageHeapLock));
+	QUITE_RETHROW(err);
 
-		sb.sem_op = 1;
-		QUITE_CHECK(semop(semid, &sb, 1) == 0);
-	}
-	else
+cleanup:
+	return err;
+}
+
+/**
+ * @brief allocate from the buddy and remember the block size so we can tell how big it is later.
+ */
+THROWS static err_t largeBlockAlloc(void **const data, size_t size)
+{
+	err_t err = NO_ERRORCODE;
+	void *block = NULL;
+	uint8_t exponent = 0;
+
+	CHECK_NOTRACE_ERRORCODE(size <= 1ul << MAX_RANGE_EXPONENT, ENOMEM);
+	exponent = getBuddyBlockExponent(size);
+
+	QUITE_RETHROW(pageHeapAlloc(&block, size));
+	QUITE_RETHROW(pagemapSetLargeBlock(&pages, block, exponent));
+	*data = block;
+
+cleanup:
+	// a block that is not in the pagemap could never be freed
+	if (err.errorCode != 0 && block != NULL)
 	{
-		QUITE_RETHROW(handleSlabAlloc(data, sizeClass, flags));
+		REWARN(pageHeapFree(&block, size));
 	}
 
-	QUITE_CHECK(*data != NULL);
-	if ((flags | ALLOCATOR_CLEAR_MEMORY) == 1)
+	return err;
+}
+
+THROWS static err_t largeBlockFree(void **const data)
+{
+	err_t err = NO_ERRORCODE;
+	const pagemapEntry *entry = pagemapGet(&pages, *data);
+
+	QUITE_CHECK(entry != NULL && entry->kind == PAGEMAP_LARGE_BLOCK);
+
+	// the buddy can't tell us when a free block is merged or reused, so a big block is released while it is still ours.
+	// the pages are only memory we give back early, the block is freed even if that fails.
+	if ((1ul << entry->blockExponent) >= SHARED_MEMORY_RELEASE_ON_FREE_SIZE)
 	{
-		bzero(*data, count * size);
+		REWARN(releaseSharedMemoryFileRange(*data, 1ul << entry->blockExponent));
 	}
 
+	QUITE_RETHROW(pagemapClear(&pages, *data));
+	QUITE_RETHROW(pageHeapFree(data, 1ul << entry->blockExponent));
+
 cleanup:
 	return err;
 }
 
-THROWS err_t sharedRealloc(void **const data, const size_t count, const size_t size, allocatorFlags flags,
-						   [[maybe_unused]] void *sharedAllocatorData)
+/**
+ * @brief find what data is from the pagemap.
+ * @param s set to the slab that holds data or to NULL if data is the start of a large block
+ */
+THROWS static err_t getOwningSlab(void *data, slab **s)
 {
 	err_t err = NO_ERRORCODE;
-	slab *s = NULL;
-	void *temp = NULL;
-
-	QUITE_CHECK(data != NULL);
-	QUITE_CHECK(*data != NULL);
-	QUITE_CHECK(size > 0);
+	const pagemapEntry *entry = pagemapGet(&pages, data);
 
-	temp = *data;
-	s = GET_SLAB_START(*data);
+	QUITE_CHECK(entry != NULL);
 
-	if (s->header.slabMagic == SLAB_MAGIC)
+	if (entry->kind == PAGEMAP_SLAB)
 	{
-		err = coreCaches[0][0].realloc(data, count, size, flags, s);
-		if (err.errorCode == ENOMEM)
-		{
-			err = NO_ERRORCODE;
-			QUITE_RETHROW(sharedAlloc(data, count, size, flags, sharedAllocatorData));
-			memcpy(*data, temp, MIN(size * count, s->header.cellSize));
-			QUITE_RETHROW(coreCaches[0][0].free(&temp, s));
-		}
-		else
-		{
-			QUITE_RETHROW(err);
-		}
+		*s = (slab *)pagemapGetPageStart(&pages, data);
 	}
 	else
 	{
-		QUITE_RETHROW(buddyFree(g_buddy, data));
-		QUITE_RETHROW(buddyAlloc(g_buddy, data, count * size));
+		QUITE_CHECK(entry->kind == PAGEMAP_LARGE_BLOCK);
+		QUITE_CHECK(pagemapGetPageStart(&pages, data) == data);
+		*s = NULL;
 	}
 
 cleanup:
 	return err;
 }
 
-THROWS err_t sharedDealloc(void **const data, [[maybe_unused]] void *sharedAllocatorData)
+/**
+ * @brief a new slab for a core cache from the page heap, the pages are first touched on that core so the kernel puts
+ * them on its node. if the page heap is out of memory we take a slab that a core on another node gave up.
+ */
+THROWS static err_t getPageHeapSlab(slabCache *cache, slab **newSlab)
 {
 	err_t err = NO_ERRORCODE;
-	slab *s = NULL;
+	err_t pageHeapErr = NO_ERRORCODE;
+	uint32_t node = getCacheNode(cache);
+	uint32_t sizeClass = getSizeClass(cache->cellSize);
 
-	QUITE_CHECK(data != NULL);
-	QUITE_CHECK(*data != NULL);
+	*newSlab = NULL;
+	pageHeapErr = pageHeapAlloc((void **)newSlab, SLAB_SIZE);
+	if (pageHeapErr.errorCode == 0)
+	{
+		QUITE_RETHROW(pagemapSetSlab(&pages, *newSlab, sizeClass));
+		atomic_fetch_add((_Atomic uint64_t *)&numaStats.nodes[node].localSlabs, 1);
+		goto cleanup;
+	}
 
-	QUITE_RETHROW(buddyGetCellStartAddrFromAddrInCell(g_buddy, *data, (void **)&s));
+	for (uint32_t i = 1; i < numaNodeCount && *newSlab == NULL; i++)
+	{
+		QUITE_RETHROW(transferCachePop(getTransferCache((node + i) % numaNodeCount, sizeClass), newSlab));
+	}
 
-	if (s->header.slabMagic == SLAB_MAGIC)
+	if (*newSlab == NULL)
 	{
-		QUITE_RETHROW(coreCaches[0][0].free(data, s));
+		QUITE_RETHROW(pageHeapErr);
 	}
-	else
+
+	atomic_fetch_add((_Atomic uint64_t *)&numaStats.nodes[node].remoteSlabs, 1);
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t handleSlabAllocError(slabCache *cache, [[maybe_unused]] void **const data,
+										 [[maybe_unused]] size_t size, [[maybe_unused]] allocatorFlags flags)
+{
+	err_t err = NO_ERRORCODE;
+	slab *tempSlab = NULL;
+
+	QUITE_RETHROW(getPageHeapSlab(cache, &tempSlab));
+
+	QUITE_RETHROW(appendSlab(cache, tempSlab));
+	atomic_fetch_add((_Atomic uint64_t *)&refillStats.foregroundRefills, 1);
+	__atomic_fetch_add(&cache->stats.slabRefills, 1, __ATOMIC_RELAXED);
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief give the slabs of a transfer cache above keepSlabs back to the buddy.
+ * a core cache only ever gives its empty slabs to the transfer cache of its class(under its lock, where we don't take
+ * the page heap lock), this is where they become free memory for every class again.
+ */
+THROWS static err_t returnSurplusSlabs(transferCache *cache, size_t keepSlabs)
+{
+	err_t err = NO_ERRORCODE;
+	slab *s = NULL;
+
+	while (atomic_load((_Atomic uint64_t *)&cache->slabCount) > keepSlabs)
 	{
-		QUITE_CHECK(s == *data);
-		QUITE_RETHROW(buddyFree(g_buddy, data));
+		QUITE_RETHROW(transferCachePop(cache, &s));
+		if (s == NULL)
+		{
+			break;
+		}
+
+		// so a stale pointer into the old slab can't pass for a cell
+		s->header.slabMagic = 0;
+		QUITE_RETHROW(pagemapClear(&pages, s));
+
+		// the pages stay on this node, the next user of the block can be on another node and should fault its own
+		if (numaNodeCount > 1)
+		{
+			QUITE_RETHROW(releaseSharedMemoryFileRange(s, SLAB_SIZE));
+		}
+
+		QUITE_RETHROW(pageHeapFree((void **)&s, SLAB_SIZE));
 	}
 
 cleanup:
-	if (data != NULL)
+	return err;
+}
+
+static slabCacheOwnerKind getCacheOwnerKind()
+{
+	if (cacheIndex == SHARED_MEMORY_CACHE_PER_CID)
 	{
-		*data = NULL;
+		return SLAB_CACHE_OWNER_MM_CID;
 	}
 
+	return cacheIndex == SHARED_MEMORY_CACHE_PER_THREAD ? SLAB_CACHE_OWNER_THREAD : SLAB_CACHE_OWNER_CPU;
+}
+
+/**
+ * @brief create the caches of an id the first time it allocates.
+ * it is done under the page heap lock so when two threads race on the same id(a thread that moved to another cpu, or
+ * another process on the same cpu) only one of them creates them.
+ */
+THROWS static err_t createCoreCaches(uint32_t id)
+{
+	err_t err = NO_ERRORCODE;
+	slabCache *caches = NULL;
+	int cpu = sched_getcpu();
+	uint32_t node = 0;
+	bool isLocked = false;
+
+	QUITE_CHECK(id < coreCachesCount);
+
+	// a concurrency id or a thread moves between cpus, its caches go on the node of the cpu it first allocated on
+	if (cacheIndex == SHARED_MEMORY_CACHE_PER_CPU)
+	{
+		node = cpuNodes[id];
+	}
+	else if (cpu >= 0 && cpu < cpuCount)
+	{
+		node = cpuNodes[cpu];
+	}
+
+	QUITE_RETHROW(lockPageHeap());
+	isLocked = true;
+
+	if (coreCaches[id].load() != NULL)
+	{
+		goto cleanup;
+	}
+
+	// the block is a whole page but only the pages the caches are on are ever touched
+	QUITE_RETHROW(buddyAlloc(g_buddy, (void **)&caches, SIZE_CLASSES_COUNT * sizeof(slabCache)));
+	for (size_t j = 0; j < SIZE_CLASSES_COUNT; j++)
+	{
+		QUITE_RETHROW(initSlabCache(&caches[j], allocationCachesSizes[j], id, getCacheOwnerKind(),
+									getTransferCache(node, j)));
+	}
+
+	coreCaches[id].store(caches);
+	poolHeader->pageHeapBytes += 1ul << getBuddyBlockExponent(SIZE_CLASSES_COUNT * sizeof(slabCache));
+	caches = NULL;
+
+cleanup:
+	if (caches != NULL)
+	{
+		REWARN(buddyFree(g_buddy, (void **)&caches));
+	}
+
+	if (isLocked)
+	{
+		REWARN(futexLockRelease(pageHeapLock));
+	}
+
+	return err;
+}
+
+/**
+ * @brief take count cells from cache, under its lock only for the batch itself so the slabs we might need are taken
+ * from the page heap without it.
+ */
+THROWS static err_t lockedAllocBatch(slabCache *cache, void **cells, size_t count, size_t *allocatedCount)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_RETHROW(futexLockAcquire(&cache->lock));
+	err = unsafeAllocBatch(cells, count, allocatedCount, cache);
+	REWARN(futexLockRelease(&cache->lock));
+	RETHROW_NOTRACE(err);
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief the allocation that just ran could have given the transfer cache of cache more slabs then it keeps.
+ */
+THROWS static err_t returnCentralSurplus(slabCache *cache)
+{
+	err_t err = NO_ERRORCODE;
+	transferCache *central = cache->centralCache;
+
+	if (atomic_load((_Atomic uint64_t *)&central->slabCount) > SHARED_MEMORY_TRANSFER_CACHE_MAX_SLABS)
+	{
+		QUITE_RETHROW(returnSurplusSlabs(central, SHARED_MEMORY_TRANSFER_CACHE_MAX_SLABS));
+	}
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief take call count cells from the core cache of the id we are on, a refill continue from allocatedCount.
+ * @note the cache is locked and not used from a rseq, so a thread that moved while it held the lock only makes the owner
+ * wait. the cells are ours either way, the caller only pushes them to the fast cells if we are still on coreId.
+ */
+THROWS static err_t allocFromCoreCache(allocBatchCall *call)
+{
+	err_t err = NO_ERRORCODE;
+	rseqIdKind kind = cacheIndex == SHARED_MEMORY_CACHE_PER_CID ? RSEQ_ID_MM_CID : RSEQ_ID_CPU;
+	slabCache *cache = NULL;
+
+	while (call->allocatedCount < call->count)
+	{
+		call->coreId = rseqGetId(kind);
+		if (call->coreId == UINT32_MAX) [[unlikely]]
+		{
+			QUITE_RETHROW(rseqInit());
+			call->coreId = rseqGetId(kind);
+		}
+
+		CHECK_NOTRACE_ERRORCODE(call->coreId < coreCachesCount, EINVAL);
+		if (coreCaches[call->coreId].load() == NULL) [[unlikely]]
+		{
+			QUITE_RETHROW(createCoreCaches(call->coreId));
+		}
+
+		cache = &coreCaches[call->coreId].load()[call->sizeClass];
+		RETHROW_BASE_NOTRACE(lockedAllocBatch(cache, call->data, call->count, &call->allocatedCount),
+							 if (err.errorCode == ENOMEM) {
+								 err = NO_ERRORCODE;
+								 QUITE_RETHROW(handleSlabAllocError(cache, NULL, cache->cellSize, 0));
+							 } else { goto cleanup; });
+	}
+
+	QUITE_RETHROW(returnCentralSurplus(cache));
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief the caches of the thread slot of this thread, the first allocation of a thread takes a slot nobody uses or
+ * shares one if they are all taken.
+ */
+THROWS static err_t acquireThreadSlot()
+{
+	err_t err = NO_ERRORCODE;
+	uint32_t start = atomic_load((_Atomic uint32_t *)&nextThreadSlot);
+	uint32_t slotId = NO_SLAB_CACHE_OWNER;
+	uint32_t expected = 0;
+
+	for (long i = 0; i < coreCachesCount && slotId == NO_SLAB_CACHE_OWNER; i++)
+	{
+		expected = 0;
+		if (atomic_compare_exchange_strong((_Atomic uint32_t *)&threadSlots[(start + i) % coreCachesCount].users,
+										   &expected, 1))
+		{
+			slotId = (start + i) % coreCachesCount;
+		}
+	}
+
+	if (slotId == NO_SLAB_CACHE_OWNER)
+	{
+		slotId = start % coreCachesCount;
+		atomic_fetch_add((_Atomic uint32_t *)&threadSlots[slotId].users, 1);
+	}
+
+	atomic_store((_Atomic uint32_t *)&nextThreadSlot, slotId + 1);
+
+	errno = pthread_setspecific(threadSlotKey, &threadSlots[slotId]);
+	if (errno != 0)
+	{
+		atomic_fetch_sub((_Atomic uint32_t *)&threadSlots[slotId].users, 1);
+		QUITE_CHECK(false);
+	}
+
+	currentThreadCacheId = slotId;
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief take the lock of the thread slot of this thread and give its caches.
+ */
+THROWS static err_t lockThreadCaches(slabCache **caches)
+{
+	err_t err = NO_ERRORCODE;
+
+	if (currentThreadCacheId == NO_SLAB_CACHE_OWNER) [[unlikely]]
+	{
+		QUITE_RETHROW(acquireThreadSlot());
+	}
+
+	if (coreCaches[currentThreadCacheId].load() == NULL) [[unlikely]]
+	{
+		QUITE_RETHROW(createCoreCaches(currentThreadCacheId));
+	}
+
+	QUITE_RETHROW(futexLockAcquire(&threadSlots[currentThreadCacheId].lock));
+	*caches = coreCaches[currentThreadCacheId].load();
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief take count cells from a thread cache we hold the lock of, a slab is added whenever it runs out.
+ */
+THROWS static err_t threadCacheAllocBatch(slabCache *cache, void **cells, size_t count, size_t *allocatedCount)
+{
+	err_t err = NO_ERRORCODE;
+
+	while (*allocatedCount < count)
+	{
+		RETHROW_BASE_NOTRACE(lockedAllocBatch(cache, cells, count, allocatedCount), if (err.errorCode == ENOMEM) {
+			err = NO_ERRORCODE;
+			QUITE_RETHROW(handleSlabAllocError(cache, NULL, cache->cellSize, 0));
+		} else { goto cleanup; });
+	}
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief allocFromCoreCache without rseq, the batch is taken under the lock of the thread slot.
+ */
+THROWS static err_t allocFromThreadCache(allocBatchCall *call)
+{
+	err_t err = NO_ERRORCODE;
+	slabCache *caches = NULL;
+
+	QUITE_RETHROW(lockThreadCaches(&caches));
+	err = threadCacheAllocBatch(&caches[call->sizeClass], call->data, call->count, &call->allocatedCount);
+	REWARN(futexLockRelease(&threadSlots[currentThreadCacheId].lock));
+	QUITE_RETHROW(err);
+
+	QUITE_RETHROW(returnCentralSurplus(&caches[call->sizeClass]));
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief a slab allocation without rseq, pop a fast cell of the thread cache or refill half of them under the same
+ * lock.
+ */
+THROWS static err_t threadCacheAlloc(void **const data, uint32_t sizeClass)
+{
+	err_t err = NO_ERRORCODE;
+	void *cells[SLAB_CACHE_FAST_CELLS] = {NULL};
+	size_t count = (getFastCellsCapacity(allocationCachesSizes[sizeClass]) + 1) / 2;
+	size_t allocatedCount = 0;
+	slabCache *caches = NULL;
+	slabCache *cache = NULL;
+	bool isLocked = false;
+
+	QUITE_RETHROW(lockThreadCaches(&caches));
+	isLocked = true;
+	cache = &caches[sizeClass];
+
+	if (slabCachePopFastCell(cache, data)) [[likely]]
+	{
+		goto cleanup;
+	}
+
+	QUITE_RETHROW(threadCacheAllocBatch(cache, cells, count, &allocatedCount));
+	*data = cells[0];
+
+	// the fast cells were empty and count is at most half of them, so every push fits
+	for (size_t i = 1; i < allocatedCount; i++)
+	{
+		QUITE_CHECK(slabCachePushFastCell(cache, cells[i]));
+	}
+
+	REWARN(futexLockRelease(&threadSlots[currentThreadCacheId].lock));
+	isLocked = false;
+
+	QUITE_RETHROW(returnCentralSurplus(cache));
+
+cleanup:
+	if (isLocked)
+	{
+		REWARN(futexLockRelease(&threadSlots[currentThreadCacheId].lock));
+	}
+
+	if (err.errorCode != 0 && allocatedCount > 0 && *data == NULL)
+	{
+		REWARN(sharedFreeBatch(cells, allocatedCount));
+	}
+
+	return err;
+}
+
+/**
+ * @brief give a cell back to the fast cells of its cache, a thread cache only if it is the one of this thread and
+ * under its lock.
+ */
+static bool pushFastCell(slabCache *cache, void *cell)
+{
+	bool isPushed = false;
+
+	if (cache->ownerKind != SLAB_CACHE_OWNER_THREAD)
+	{
+		return slabCachePushFastCell(cache, cell);
+	}
+
+	if (cache->ownerId != currentThreadCacheId ||
+		futexLockAcquire(&threadSlots[currentThreadCacheId].lock).errorCode != 0)
+	{
+		return false;
+	}
+
+	isPushed = slabCachePushFastCell(cache, cell);
+	REWARN(futexLockRelease(&threadSlots[currentThreadCacheId].lock));
+
+	return isPushed;
+}
+
+/**
+ * @brief the fast path of a slab allocation, pop a fast cell of the cache we are on with one rseq.
+ */
+static bool popCoreFastCell(uint32_t sizeClass, void **const data)
+{
+	uint32_t id = rseqGetId(cacheIndex == SHARED_MEMORY_CACHE_PER_CID ? RSEQ_ID_MM_CID : RSEQ_ID_CPU);
+	slabCache *caches = NULL;
+
+	if (id >= coreCachesCount || (caches = coreCaches[id].load()) == NULL)
+	{
+		return false;
+	}
+
+	return slabCachePopFastCell(&caches[sizeClass], data);
+}
+
+/**
+ * @brief the slow path of a slab allocation, take half of the fast cells of the class in one batch, give one to data
+ * and push the rest so the next allocations with this id only pop.
+ */
+THROWS static err_t refillCoreFastCells(void **const data, uint32_t sizeClass)
+{
+	err_t err = NO_ERRORCODE;
+	void *cells[SLAB_CACHE_FAST_CELLS] = {NULL};
+	size_t count = (getFastCellsCapacity(allocationCachesSizes[sizeClass]) + 1) / 2;
+	allocBatchCall call = {cells, count, 0, sizeClass, UINT32_MAX};
+	slabCache *cache = NULL;
+	size_t pushedCount = 1;
+
+	QUITE_RETHROW(allocFromCoreCache(&call));
+	*data = cells[0];
+
+	// if we moved since the batch they are not our cells to push anymore
+	cache = &coreCaches[call.coreId].load()[sizeClass];
+	while (pushedCount < call.allocatedCount && slabCachePushFastCell(cache, cells[pushedCount]))
+	{
+		pushedCount++;
+	}
+
+	if (pushedCount < call.allocatedCount)
+	{
+		REWARN(sharedFreeBatch(&cells[pushedCount], call.allocatedCount - pushedCount));
+	}
+
+cleanup:
+	if (err.errorCode != 0 && call.allocatedCount > 0 && *data == NULL)
+	{
+		REWARN(sharedFreeBatch(cells, call.allocatedCount));
+	}
+
+	return err;
+}
+
+THROWS static err_t handleSlabAlloc(void **const data, uint32_t sizeClass)
+{
+	err_t err = NO_ERRORCODE;
+
+	if (cacheIndex == SHARED_MEMORY_CACHE_PER_THREAD)
+	{
+		QUITE_RETHROW(threadCacheAlloc(data, sizeClass));
+		goto cleanup;
+	}
+
+	if (popCoreFastCell(sizeClass, data)) [[likely]]
+	{
+		goto cleanup;
+	}
+
+	QUITE_RETHROW(refillCoreFastCells(data, sizeClass));
+
+cleanup:
+	return err;
+}
+
+THROWS err_t sharedAllocBatch(void **out, size_t n, size_t size)
+{
+	err_t err = NO_ERRORCODE;
+	allocBatchCall call = {out, n, 0, UINT32_MAX, UINT32_MAX};
+
+	QUITE_CHECK(out != NULL);
+	QUITE_CHECK(n > 0);
+	QUITE_CHECK(size > 0);
+
+	call.sizeClass = getSizeClass(size);
+	if (call.sizeClass == UINT32_MAX)
+	{
+		for (; call.allocatedCount < n; call.allocatedCount++)
+		{
+			out[call.allocatedCount] = NULL;
+			QUITE_RETHROW(largeBlockAlloc(&out[call.allocatedCount], size));
+		}
+
+		goto cleanup;
+	}
+
+	if (cacheIndex == SHARED_MEMORY_CACHE_PER_THREAD)
+	{
+		QUITE_RETHROW(allocFromThreadCache(&call));
+	}
+	else
+	{
+		QUITE_RETHROW(allocFromCoreCache(&call));
+	}
+
+cleanup:
+	if (err.errorCode != 0 && call.allocatedCount > 0)
+	{
+		REWARN(sharedFreeBatch(out, call.allocatedCount));
+	}
+
+	return err;
+}
+
+THROWS err_t sharedAlloc(void **const data, const size_t count, const size_t size, allocatorFlags flags,
+						 [[maybe_unused]] void *sharedAllocatorData)
+{
+	err_t err = NO_ERRORCODE;
+	uint32_t sizeClass = UINT32_MAX;
+	size_t totalSize = 0;
+
+	QUITE_CHECK(data != NULL);
+	QUITE_CHECK(*data == NULL);
+	QUITE_CHECK(size > 0);
+	CHECK_NOTRACE_ERRORCODE(!__builtin_mul_overflow(count, size, &totalSize), ENOMEM);
+
+	sizeClass = getSizeClass(totalSize);
+	if (sizeClass == UINT32_MAX)
+	{
+		QUITE_RETHROW(largeBlockAlloc(data, totalSize));
+	}
+	else
+	{
+		QUITE_RETHROW(handleSlabAlloc(data, sizeClass));
+	}
+
+	QUITE_CHECK(*data != NULL);
+	if ((flags & ALLOCATOR_CLEAR_MEMORY) != 0)
+	{
+		bzero(*data, totalSize);
+	}
+
+cleanup:
+	return err;
+}
+
+static int comparePointers(const void *a, const void *b)
+{
+	return (*(uint8_t *const *)a > *(uint8_t *const *)b) - (*(uint8_t *const *)a < *(uint8_t *const *)b);
+}
+
+/**
+ * @brief free the run of pointers at the start of ptrs that are in the same slab(or a single large block) and set them
+ * to NULL.
+ * @param runLength set to how many pointers the run has even on error, a pointer that is not ours is a run of its own
+ */
+THROWS static err_t freeBatchRun(void **ptrs, size_t n, size_t *runLength)
+{
+	err_t err = NO_ERRORCODE;
+	slab *s = NULL;
+	slab *nextSlab = NULL;
+
+	*runLength = 1;
+	QUITE_CHECK(ptrs[0] != NULL);
+
+	QUITE_RETHROW(getOwningSlab(ptrs[0], &s));
+	if (s == NULL)
+	{
+		QUITE_RETHROW(largeBlockFree(&ptrs[0]));
+		ptrs[0] = NULL;
+		goto cleanup;
+	}
+
+	while (*runLength < n && ptrs[*runLength] != NULL &&
+		   getOwningSlab(ptrs[*runLength], &nextSlab).errorCode == 0 && nextSlab == s)
+	{
+		(*runLength)++;
+	}
+
+	QUITE_RETHROW(unsafeDeallocBatch(ptrs, *runLength, s));
+	bzero(ptrs, *runLength * sizeof(void *));
+
+cleanup:
+	return err;
+}
+
+THROWS err_t sharedFreeBatch(void **ptrs, size_t n)
+{
+	err_t err = NO_ERRORCODE;
+	err_t runErr = NO_ERRORCODE;
+	size_t runLength = 0;
+
+	QUITE_CHECK(ptrs != NULL);
+
+	// sorting puts the cells of a slab next to each other and the cells that share a free list byte too
+	qsort(ptrs, n, sizeof(void *), comparePointers);
+
+	// a run that fails doesn't stop the ones after it, the first error is returned
+	for (size_t i = 0; i < n; i += runLength)
+	{
+		runErr = freeBatchRun(&ptrs[i], n - i, &runLength);
+		if (runErr.errorCode != 0 && err.errorCode == 0)
+		{
+			err = runErr;
+		}
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS err_t sharedAlignedAlloc(void **const data, const size_t count, const size_t size, const size_t alignment,
+								allocatorFlags flags, void *sharedAllocatorData)
+{
+	err_t err = NO_ERRORCODE;
+	uint32_t sizeClass = UINT32_MAX;
+	size_t totalSize = 0;
+
+	QUITE_CHECK(data != NULL);
+	QUITE_CHECK(*data == NULL);
+	QUITE_CHECK(size > 0);
+	CHECK_NOTRACE_ERRORCODE(!__builtin_mul_overflow(count, size, &totalSize), ENOMEM);
+	CHECK_NOTRACE_ERRORCODE(alignment > 0 && (alignment & (alignment - 1)) == 0, EINVAL);
+	CHECK_NOTRACE_ERRORCODE(alignment <= SHARED_MEMORY_FILE_ALIGNMENT, EINVAL);
+
+	if (alignment <= defaultSlabLayout::cellAlignment(allocationCachesSizes[0]))
+	{
+		QUITE_RETHROW(sharedAlloc(data, count, size, flags, sharedAllocatorData));
+		goto cleanup;
+	}
+
+	sizeClass = defaultPoolConfig::getAlignedSizeClass(totalSize, alignment);
+	if (sizeClass == UINT32_MAX)
+	{
+		// a buddy block is aligned to its size
+		QUITE_RETHROW(largeBlockAlloc(data, MAX(totalSize, MAX(alignment, defaultPoolConfig::maxCellSize + 1))));
+	}
+	else
+	{
+		QUITE_RETHROW(handleSlabAlloc(data, sizeClass));
+	}
+
+	QUITE_CHECK(*data != NULL);
+	QUITE_CHECK(((size_t)*data & (alignment - 1)) == 0);
+	if ((flags & ALLOCATOR_CLEAR_MEMORY) != 0)
+	{
+		bzero(*data, totalSize);
+	}
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief realloc by allocating a new block, copying oldSize bytes(or less if the new block is smaller) and freeing the
+ * old one, the old block is kept if we fail to allocate.
+ */
+THROWS static err_t moveAllocation(void **const data, size_t oldSize, size_t newSize, allocatorFlags flags)
+{
+	err_t err = NO_ERRORCODE;
+	void *newData = NULL;
+	void *oldData = *data;
+
+	QUITE_RETHROW(sharedAlloc(&newData, 1, newSize, flags, NULL));
+	memcpy(newData, oldData, MIN(oldSize, newSize));
+	QUITE_RETHROW(sharedDealloc(&oldData, NULL));
+	*data = newData;
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief a large block is kept as long as the new size still fits it, if it is less then half of the block the pages
+ * after the next power of 2 of the new size are given back to the kernel so only the address range stays used. the
+ * part that is left is kept in the pagemap, so a move later copies only that.
+ * @note the buddy only allocates and frees whole blocks, it can't give us a free buddy of the block to grow into or
+ * take back the tail of one, so a grow past the block is always a move and a shrink keeps the whole range. the memfd
+ * can't move pages between offsets either, so a move is a copy of the live part.
+ */
+THROWS static err_t reallocLargeBlock(void **const data, size_t newSize, allocatorFlags flags)
+{
+	err_t err = NO_ERRORCODE;
+	const pagemapEntry *entry = pagemapGet(&pages, *data);
+	uint8_t *blockStart = (uint8_t *)pagemapGetPageStart(&pages, *data);
+	size_t blockSize = 0;
+	size_t liveSize = 0;
+	uint8_t liveExponent = 0;
+
+	QUITE_CHECK(entry != NULL && entry->kind == PAGEMAP_LARGE_BLOCK);
+	blockSize = 1ul << entry->blockExponent;
+	liveSize = 1ul << entry->liveExponent;
+
+	// an aligned allocation can start after the start of its block
+	if (newSize <= defaultPoolConfig::maxCellSize || newSize > blockSize - ((uint8_t *)*data - blockStart))
+	{
+		QUITE_RETHROW(moveAllocation(data, liveSize - ((uint8_t *)*data - blockStart), newSize, flags));
+		goto cleanup;
+	}
+
+	liveExponent = entry->blockExponent;
+	if (newSize <= blockSize / 2)
+	{
+		liveExponent = MIN(getBuddyBlockExponent(MAX(newSize + ((uint8_t *)*data - blockStart),
+													 SHARED_REALLOC_RELEASE_GRANULARITY)),
+						   liveExponent);
+	}
+
+	// a grow in place only marks more of the block as used, the pages come back when they are written
+	if ((1ul << liveExponent) < liveSize)
+	{
+		QUITE_RETHROW(
+			releaseSharedMemoryFileRange(blockStart + (1ul << liveExponent), liveSize - (1ul << liveExponent)));
+	}
+
+	QUITE_RETHROW(pagemapSetLargeBlockLiveSize(&pages, blockStart, liveExponent));
+
+cleanup:
+	return err;
+}
+
+THROWS err_t sharedRealloc(void **const data, const size_t count, const size_t size, allocatorFlags flags,
+						   [[maybe_unused]] void *sharedAllocatorData)
+{
+	err_t err = NO_ERRORCODE;
+	slab *s = NULL;
+	size_t newSize = 0;
+
+	QUITE_CHECK(data != NULL);
+	QUITE_CHECK(*data != NULL);
+	QUITE_CHECK(count > 0 && size > 0);
+	QUITE_CHECK(!__builtin_mul_overflow(count, size, &newSize));
+
+	QUITE_RETHROW(getOwningSlab(*data, &s));
+
+	if (s == NULL)
+	{
+		QUITE_RETHROW(reallocLargeBlock(data, newSize, flags));
+	}
+	else if (newSize <= s->header.cellSize &&
+			 getSizeClass(newSize) + SHARED_REALLOC_SHRINK_CLASSES > getSizeClass(s->header.cellSize))
+	{
+		// the cell still fits and is not that much to big, keep it
+		QUITE_RETHROW(unsafeRealloc(data, count, size, flags, s));
+	}
+	else
+	{
+		// grow, or a shrink big enough that the cell is better off in its own class
+		QUITE_RETHROW(moveAllocation(data, s->header.cellSize, newSize, flags));
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS err_t sharedDealloc(void **const data, [[maybe_unused]] void *sharedAllocatorData)
+{
+	err_t err = NO_ERRORCODE;
+	slab *s = NULL;
+
+	QUITE_CHECK(data != NULL);
+	QUITE_CHECK(*data != NULL);
+
+	QUITE_RETHROW(getOwningSlab(*data, &s));
+
+	if (s == NULL)
+	{
+		QUITE_RETHROW(largeBlockFree(data));
+	}
+	else
+	{
+		// the fast cells never look at the slab, so a bad or freed pointer is caught before it gets there
+		QUITE_RETHROW(unsafeCheckCell(*data, s));
+		if (!pushFastCell(s->header.owner, *data))
+		{
+			QUITE_RETHROW(unsafeDealloc(data, s));
+		}
+	}
+
+cleanup:
+	if (data != NULL)
+	{
+		*data = NULL;
+	}
+
+	return err;
+}
+
+THROWS err_t sharedDeallocSized(void **const data, const size_t size, [[maybe_unused]] void *sharedAllocatorData)
+{
+	err_t err = NO_ERRORCODE;
+	slab *s = NULL;
+#ifndef NDEBUG
+	const pagemapEntry *entry = NULL;
+#endif
+
+	QUITE_CHECK(data != NULL);
+	QUITE_CHECK(*data != NULL);
+	QUITE_CHECK(size > 0);
+
+	// a slab cell is never at the start of a page(the slab header is there) and a large block always is, so the
+	// address tells which one it is without even reading the pagemap. the size only matters to check the caller.
+	s = (slab *)pagemapGetPageStart(&pages, *data);
+	if (s == *data)
+	{
+		s = NULL;
+	}
+
+#ifndef NDEBUG
+	entry = pagemapGet(&pages, *data);
+	QUITE_CHECK(entry != NULL);
+	QUITE_CHECK(entry->kind == (s == NULL ? PAGEMAP_LARGE_BLOCK : PAGEMAP_SLAB));
+	QUITE_CHECK(s != NULL || size <= (1ul << entry->blockExponent));
+#endif
+
+	if (s == NULL)
+	{
+		QUITE_RETHROW(largeBlockFree(data));
+	}
+	else
+	{
+		// a bad pointer or size is caught here, before the fast cells that never look at the slab
+		QUITE_RETHROW(unsafeCheckCell(*data, s));
+		QUITE_CHECK(size <= s->header.cellSize);
+		if (!pushFastCell(s->header.owner, *data))
+		{
+			QUITE_RETHROW(unsafeDeallocSized(data, size, s));
+		}
+	}
+
+cleanup:
+	if (data != NULL)
+	{
+		*data = NULL;
+	}
+
+	return err;
+}
+
+THROWS err_t sharedGetUsableSize(void *const data, size_t *size)
+{
+	err_t err = NO_ERRORCODE;
+	const pagemapEntry *entry = NULL;
+
+	QUITE_CHECK(data != NULL);
+	QUITE_CHECK(size != NULL);
+
+	entry = pagemapGet(&pages, data);
+	QUITE_CHECK(entry != NULL);
+
+	if (entry->kind == PAGEMAP_SLAB)
+	{
+		*size = allocationCachesSizes[entry->sizeClass];
+	}
+	else
+	{
+		// only the first page of a large block is in the pagemap
+		QUITE_CHECK(entry->kind == PAGEMAP_LARGE_BLOCK);
+		*size = (1ul << entry->liveExponent) - ((size_t)data - (size_t)pagemapGetPageStart(&pages, data));
+	}
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief top up the empty slabs of one core cache, slabs other cores gave up are used before new slabs from the buddy.
+ */
+THROWS static err_t refillCoreCache(slabCache *cache, const sharedMemoryRefillConfig *config)
+{
+	err_t err = NO_ERRORCODE;
+	size_t emptySlabCount = atomic_load((_Atomic size_t *)&cache->emptySlabCount);
+	slab *newSlab = NULL;
+
+	if (emptySlabCount >= config->lowWatermark)
+	{
+		goto cleanup;
+	}
+
+	for (; emptySlabCount < config->highWatermark; emptySlabCount++)
+	{
+		newSlab = NULL;
+		QUITE_RETHROW(transferCachePop(cache->centralCache, &newSlab));
+		if (newSlab != NULL)
+		{
+			atomic_fetch_add((_Atomic uint64_t *)&numaStats.nodes[getCacheNode(cache)].localSlabs, 1);
+		}
+		else
+		{
+			QUITE_RETHROW(getPageHeapSlab(cache, &newSlab));
+		}
+
+		QUITE_RETHROW(appendSlab(cache, newSlab));
+		atomic_fetch_add((_Atomic uint64_t *)&refillStats.backgroundRefills, 1);
+		__atomic_fetch_add(&cache->stats.slabRefills, 1, __ATOMIC_RELAXED);
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS err_t refillSharedMemoryCaches(const sharedMemoryRefillConfig *config)
+{
+	err_t err = NO_ERRORCODE;
+	slabCache *caches = NULL;
+
+	QUITE_CHECK(config != NULL);
+	QUITE_CHECK(config->lowWatermark <= config->highWatermark);
+	QUITE_CHECK(coreCaches != NULL);
+
+	for (long i = 0; i < coreCachesCount; i++)
+	{
+		caches = coreCaches[i].load();
+		if (caches == NULL)
+		{
+			continue;
+		}
+
+		for (size_t j = 0; j < SIZE_CLASSES_COUNT; j++)
+		{
+			QUITE_RETHROW(refillCoreCache(&caches[j], config));
+		}
+	}
+
+cleanup:
+	return err;
+}
+
+static void *refillerMain([[maybe_unused]] void *arg)
+{
+	while (atomic_load((_Atomic bool *)&isRefillerRunning))
+	{
+		REWARN(refillSharedMemoryCaches(&refillerConfig));
+		usleep(refillerConfig.interval);
+	}
+
+	return NULL;
+}
+
+THROWS err_t startSharedMemoryRefiller(const sharedMemoryRefillConfig *config)
+{
+	err_t err = NO_ERRORCODE;
+	bool expected = false;
+
+	QUITE_CHECK(config != NULL);
+	QUITE_CHECK(config->lowWatermark <= config->highWatermark);
+	QUITE_CHECK(config->highWatermark <= SLAB_CACHE_EMPTY_HIGH_WATERMARK);
+	QUITE_CHECK(coreCaches != NULL);
+
+	QUITE_CHECK(atomic_compare_exchange_strong((_Atomic bool *)&isRefillerRunning, &expected, true));
+	refillerConfig = *config;
+
+	errno = pthread_create(&refillerThread, NULL, refillerMain, NULL);
+	if (errno != 0)
+	{
+		atomic_store((_Atomic bool *)&isRefillerRunning, false);
+		QUITE_CHECK(false);
+	}
+
+cleanup:
+	return err;
+}
+
+err_t stopSharedMemoryRefiller()
+{
+	err_t err = NO_ERRORCODE;
+	bool expected = true;
+
+	if (!atomic_compare_exchange_strong((_Atomic bool *)&isRefillerRunning, &expected, false))
+	{
+		goto cleanup;
+	}
+
+	errno = pthread_join(refillerThread, NULL);
+	QUITE_CHECK(errno == 0);
+
+cleanup:
+	return err;
+}
+
+THROWS err_t getSharedMemoryRefillStats(sharedMemoryRefillStats *stats)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(stats != NULL);
+
+	stats->foregroundRefills = atomic_load((_Atomic uint64_t *)&refillStats.foregroundRefills);
+	stats->backgroundRefills = atomic_load((_Atomic uint64_t *)&refillStats.backgroundRefills);
+
+cleanup:
+	return err;
+}
+
+THROWS err_t getSharedMemoryNumaStats(sharedMemoryNumaStats *stats)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(stats != NULL);
+
+	stats->nodeCount = numaNodeCount;
+	for (uint32_t i = 0; i < numaNodeCount; i++)
+	{
+		stats->nodes[i].localSlabs = atomic_load((_Atomic uint64_t *)&numaStats.nodes[i].localSlabs);
+		stats->nodes[i].remoteSlabs = atomic_load((_Atomic uint64_t *)&numaStats.nodes[i].remoteSlabs);
+	}
+
+cleanup:
+	return err;
+}
+
+static_assert(SIZE_CLASSES_COUNT <= SHARED_MEMORY_STATS_MAX_CLASSES);
+
+static void addClassStats(sharedMemoryClassStats *sum, const slabCache *cache)
+{
+	uint64_t fastCellsState = __atomic_load_n(&cache->fastCellsState, __ATOMIC_RELAXED);
+
+	// every pop took one from the count and every push added one, so with how many of both there were we get each
+	sum->cellSize = cache->cellSize;
+	sum->fastAllocs += (rseqStackOperations(fastCellsState) - rseqStackCount(fastCellsState)) / 2;
+	sum->fastFrees += (rseqStackOperations(fastCellsState) + rseqStackCount(fastCellsState)) / 2;
+	sum->slabAllocs += __atomic_load_n(&cache->stats.slabAllocs, __ATOMIC_RELAXED);
+	sum->slabFrees += __atomic_load_n(&cache->stats.slabFrees, __ATOMIC_RELAXED);
+	sum->remoteFrees += __atomic_load_n(&cache->stats.remoteFrees, __ATOMIC_RELAXED);
+	sum->slabRefills += __atomic_load_n(&cache->stats.slabRefills, __ATOMIC_RELAXED);
+	sum->slabCount += __atomic_load_n(&cache->stats.slabCount, __ATOMIC_RELAXED);
+}
+
+THROWS err_t getSharedMemoryCacheCount(uint32_t *count)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(count != NULL);
+	QUITE_CHECK(coreCaches != NULL);
+
+	*count = (uint32_t)coreCachesCount;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t getSharedMemoryCacheStats(uint32_t id, sharedMemoryCacheStats *stats)
+{
+	err_t err = NO_ERRORCODE;
+	slabCache *caches = NULL;
+
+	QUITE_CHECK(stats != NULL);
+	QUITE_CHECK(coreCaches != NULL);
+	QUITE_CHECK(id < coreCachesCount);
+
+	caches = coreCaches[id].load();
+	CHECK_NOTRACE_ERRORCODE(caches != NULL, ENOENT);
+
+	bzero(stats, sizeof(*stats));
+	stats->node = getCacheNode(&caches[0]);
+	stats->classCount = SIZE_CLASSES_COUNT;
+	for (size_t j = 0; j < SIZE_CLASSES_COUNT; j++)
+	{
+		addClassStats(&stats->classes[j], &caches[j]);
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS err_t getSharedMemoryStats(sharedMemoryStats *stats)
+{
+	err_t err = NO_ERRORCODE;
+	slabCache *caches = NULL;
+
+	QUITE_CHECK(stats != NULL);
+	QUITE_CHECK(poolHeader != NULL);
+
+	bzero(stats, sizeof(*stats));
+	stats->cacheIndex = cacheIndex;
+	stats->classCount = SIZE_CLASSES_COUNT;
+	for (long i = 0; i < coreCachesCount; i++)
+	{
+		if (threadSlots != NULL)
+		{
+			stats->threadCacheLockWaits += atomic_load((_Atomic uint32_t *)&threadSlots[i].lock.waits);
+		}
+
+		caches = coreCaches[i].load();
+		if (caches == NULL)
+		{
+			continue;
+		}
+
+		stats->cacheCount++;
+		for (size_t j = 0; j < SIZE_CLASSES_COUNT; j++)
+		{
+			addClassStats(&stats->classes[j], &caches[j]);
+			stats->slabCacheLockWaits += atomic_load((_Atomic uint32_t *)&caches[j].lock.waits);
+		}
+	}
+
+	stats->pageHeapLockWaits = atomic_load((_Atomic uint32_t *)&poolHeader->pageHeapLock.waits);
+	stats->pageHeapBytes = atomic_load((_Atomic uint64_t *)&poolHeader->pageHeapBytes);
+	QUITE_RETHROW(getSharedMemoryFileSize(&stats->fileSize));
+
+cleanup:
+	return err;
+}
+
+static const char *const cacheIndexNames[] = {"cpu", "cid", "thread"};
+
+THROWS static err_t dumpClassStats(int fd, sharedMemoryStatsFormat format, const sharedMemoryClassStats *classes,
+								   uint32_t classCount)
+{
+	err_t err = NO_ERRORCODE;
+	const sharedMemoryClassStats *c = NULL;
+
+	if (format == SHARED_MEMORY_STATS_TEXT)
+	{
+		QUITE_CHECK(dprintf(fd, "%10s %12s %12s %12s %12s %12s %8s %8s\n", "cell", "fastAllocs", "fastFrees",
+							"slabAllocs", "slabFrees", "remoteFrees", "refills", "slabs") >= 0);
+	}
+
+	for (uint32_t j = 0; j < classCount; j++)
+	{
+		c = &classes[j];
+		if (format == SHARED_MEMORY_STATS_TEXT)
+		{
+			QUITE_CHECK(dprintf(fd, "%10zu %12lu %12lu %12lu %12lu %12lu %8lu %8lu\n", c->cellSize, c->fastAllocs,
+								c->fastFrees, c->slabAllocs, c->slabFrees, c->remoteFrees, c->slabRefills,
+								c->slabCount) >= 0);
+		}
+		else
+		{
+			QUITE_CHECK(dprintf(fd,
+								"%s{\"cellSize\":%zu,\"fastAllocs\":%lu,\"fastFrees\":%lu,\"slabAllocs\":%lu,"
+								"\"slabFrees\":%lu,\"remoteFrees\":%lu,\"slabRefills\":%lu,\"slabCount\":%lu}",
+								j == 0 ? "" : ",", c->cellSize, c->fastAllocs, c->fastFrees, c->slabAllocs,
+								c->slabFrees, c->remoteFrees, c->slabRefills, c->slabCount) >= 0);
+		}
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS err_t dumpSharedMemoryStats(int fd, sharedMemoryStatsFormat format)
+{
+	err_t err = NO_ERRORCODE;
+	sharedMemoryStats stats;
+	sharedMemoryCacheStats cacheStats;
+	bool isFirstCache = true;
+
+	QUITE_CHECK(fd >= 0);
+	QUITE_CHECK(format == SHARED_MEMORY_STATS_TEXT || format == SHARED_MEMORY_STATS_JSON);
+	QUITE_RETHROW(getSharedMemoryStats(&stats));
+
+	if (format == SHARED_MEMORY_STATS_TEXT)
+	{
+		QUITE_CHECK(dprintf(fd,
+							"caches: per %s, %u created\n"
+							"page heap: %lu bytes in use of a %lu bytes file, %lu lock waits\n"
+							"thread caches: %lu lock waits\n"
+							"slab caches: %lu lock waits\n",
+							cacheIndexNames[stats.cacheIndex], stats.cacheCount, stats.pageHeapBytes, stats.fileSize,
+							stats.pageHeapLockWaits, stats.threadCacheLockWaits, stats.slabCacheLockWaits) >= 0);
+	}
+	else
+	{
+		QUITE_CHECK(dprintf(fd,
+							"{\"cacheIndex\":\"%s\",\"cacheCount\":%u,\"pageHeapBytes\":%lu,\"fileSize\":%lu,"
+							"\"pageHeapLockWaits\":%lu,\"threadCacheLockWaits\":%lu,\"slabCacheLockWaits\":%lu,"
+							"\"classes\":[",
+							cacheIndexNames[stats.cacheIndex], stats.cacheCount, stats.pageHeapBytes, stats.fileSize,
+							stats.pageHeapLockWaits, stats.threadCacheLockWaits, stats.slabCacheLockWaits) >= 0);
+	}
+
+	QUITE_RETHROW(dumpClassStats(fd, format, stats.classes, stats.classCount));
+	if (format == SHARED_MEMORY_STATS_JSON)
+	{
+		QUITE_CHECK(dprintf(fd, "],\"caches\":[") >= 0);
+	}
+
+	for (uint32_t i = 0; i < coreCachesCount; i++)
+	{
+		if (coreCaches[i].load() == NULL)
+		{
+			continue;
+		}
+
+		QUITE_RETHROW(getSharedMemoryCacheStats(i, &cacheStats));
+		if (format == SHARED_MEMORY_STATS_TEXT)
+		{
+			QUITE_CHECK(dprintf(fd, "cache %u(node %u):\n", i, cacheStats.node) >= 0);
+		}
+		else
+		{
+			QUITE_CHECK(dprintf(fd, "%s{\"id\":%u,\"node\":%u,\"classes\":[", isFirstCache ? "" : ",", i,
+								cacheStats.node) >= 0);
+		}
+
+		QUITE_RETHROW(dumpClassStats(fd, format, cacheStats.classes, cacheStats.classCount));
+		if (format == SHARED_MEMORY_STATS_JSON)
+		{
+			QUITE_CHECK(dprintf(fd, "]}") >= 0);
+		}
+
+		isFirstCache = false;
+	}
+
+	if (format == SHARED_MEMORY_STATS_JSON)
+	{
+		QUITE_CHECK(dprintf(fd, "]}\n") >= 0);
+	}
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief release the pages of a slab after its free list, the first page(header and free list) stays.
+ */
+THROWS static err_t releaseSlab(slab *s, size_t *releasedBytes)
+{
+	err_t err = NO_ERRORCODE;
+	uint8_t *releaseStart = &s->cache[s->header.owner->freeListSize];
+
+	if (s->header.isReleased)
+	{
+		goto cleanup;
+	}
+
+	QUITE_RETHROW(releaseSharedMemoryFileRange(releaseStart, (uint8_t *)s + SLAB_SIZE - releaseStart));
+	s->header.isReleased = true;
+	*releasedBytes += (uint8_t *)s + SLAB_SIZE - releaseStart;
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief release the bottom releaseCount slabs of a transfer cache.
+ * we take the whole chain so the slabs keep there order, the ones on top are the last pushed and the first to be used.
+ */
+THROWS static err_t scavengeTransferCache(transferCache *cache, size_t releaseCount, size_t *releasedBytes)
+{
+	err_t err = NO_ERRORCODE;
+	slab *first = NULL;
+	slab *last = NULL;
+	size_t count = 0;
+	size_t keepCount = 0;
+	size_t i = 0;
+
+	if (releaseCount == 0)
+	{
+		goto cleanup;
+	}
+
+	QUITE_RETHROW(transferCachePopAll(cache, &first, &last, &count));
+
+	keepCount = count > releaseCount ? count - releaseCount : 0;
+	for (slab *s = first; s != NULL; s = s->header.nextSlab, i++)
+	{
+		if (i >= keepCount)
+		{
+			QUITE_RETHROW(releaseSlab(s, releasedBytes));
+		}
+	}
+
+cleanup:
+	if (first != NULL)
+	{
+		REWARN(transferCachePush(cache, first, last, count));
+	}
+
+	return err;
+}
+
+THROWS err_t scavengeSharedMemory(const sharedMemoryScavengeConfig *config, size_t *releasedBytes)
+{
+	err_t err = NO_ERRORCODE;
+	size_t idleCounts[NUMA_MAX_NODES * SIZE_CLASSES_COUNT] = {0};
+	size_t idleBytes = 0;
+	size_t released = 0;
+
+	QUITE_CHECK(config != NULL);
+	QUITE_CHECK(transferCaches != NULL);
+
+	for (size_t i = 0; i < numaNodeCount * SIZE_CLASSES_COUNT; i++)
+	{
+		QUITE_RETHROW(transferCacheTakeIdleCount(&transferCaches[i], &idleCounts[i]));
+		idleCounts[i] = idleCounts[i] > config->keepSlabs ? idleCounts[i] - config->keepSlabs : 0;
+		idleBytes += idleCounts[i] * SLAB_SIZE;
+	}
+
+	// a small amount of idle memory is cheaper to keep then to fault back in
+	if (idleBytes < config->threshold)
+	{
+		goto cleanup;
+	}
+
+	for (size_t i = 0; i < numaNodeCount * SIZE_CLASSES_COUNT; i++)
+	{
+		QUITE_RETHROW(scavengeTransferCache(&transferCaches[i], idleCounts[i], &released));
+		QUITE_RETHROW(returnSurplusSlabs(&transferCaches[i], SHARED_MEMORY_TRANSFER_CACHE_MAX_SLABS));
+	}
+
+cleanup:
+	if (releasedBytes != NULL)
+	{
+		*releasedBytes = released;
+	}
+
+	return err;
+}
+
+THROWS err_t sharedMemoryTrim(size_t *releasedBytes)
+{
+	err_t err = NO_ERRORCODE;
+	size_t released = 0;
+
+	QUITE_CHECK(transferCaches != NULL);
+
+	for (size_t i = 0; i < numaNodeCount * SIZE_CLASSES_COUNT; i++)
+	{
+		QUITE_RETHROW(scavengeTransferCache(&transferCaches[i], SIZE_MAX, &released));
+		QUITE_RETHROW(returnSurplusSlabs(&transferCaches[i], SHARED_MEMORY_TRANSFER_CACHE_MAX_SLABS));
+	}
+
+cleanup:
+	if (releasedBytes != NULL)
+	{
+		*releasedBytes = released;
+	}
+
+	return err;
+}
+
+static void *scavengerMain([[maybe_unused]] void *arg)
+{
+	while (atomic_load((_Atomic bool *)&isScavengerRunning))
+	{
+		REWARN(scavengeSharedMemory(&scavengerConfig, NULL));
+		usleep(scavengerConfig.interval);
+	}
+
+	return NULL;
+}
+
+THROWS err_t startSharedMemoryScavenger(const sharedMemoryScavengeConfig *config)
+{
+	err_t err = NO_ERRORCODE;
+	bool expected = false;
+
+	QUITE_CHECK(config != NULL);
+	QUITE_CHECK(transferCaches != NULL);
+
+	QUITE_CHECK(atomic_compare_exchange_strong((_Atomic bool *)&isScavengerRunning, &expected, true));
+	scavengerConfig = *config;
+
+	errno = pthread_create(&scavengerThread, NULL, scavengerMain, NULL);
+	if (errno != 0)
+	{
+		atomic_store((_Atomic bool *)&isScavengerRunning, false);
+		QUITE_CHECK(false);
+	}
+
+cleanup:
+	return err;
+}
+
+err_t stopSharedMemoryScavenger()
+{
+	err_t err = NO_ERRORCODE;
+	bool expected = true;
+
+	if (!atomic_compare_exchange_strong((_Atomic bool *)&isScavengerRunning, &expected, false))
+	{
+		goto cleanup;
+	}
+
+	errno = pthread_join(scavengerThread, NULL);
+	QUITE_CHECK(errno == 0);
+
+cleanup:
 	return err;
 }
 
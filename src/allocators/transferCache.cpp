@@ -0,0 +1,160 @@
+#include "allocators/transferCache.h"
+
+#include "allocators/unsafeAllocator.h"
+
+#include "defaultTrace.h"
+
+#include "err.h"
+
+#include <stdatomic.h>
+#include <sys/param.h>
+
+// the low bits of the head are the signed offset of the slab from the cache(0 is an empty list, a slab is never at the
+// cache itself), the high bits are the tag
+static constexpr const uint64_t TRANSFER_CACHE_OFFSET_BITS = 40;
+static constexpr const uint64_t TRANSFER_CACHE_OFFSET_MASK = (1ul << TRANSFER_CACHE_OFFSET_BITS) - 1;
+
+// a slab has to be this close to the cache, in both directions
+static constexpr const int64_t TRANSFER_CACHE_MAX_DISTANCE = 1l << (TRANSFER_CACHE_OFFSET_BITS - 1);
+
+static slab *getHeadSlab(transferCache *cache, uint64_t head)
+{
+	// move the offset to the top of the word so the shift back extends its sign
+	int64_t offset = (int64_t)(head << (64 - TRANSFER_CACHE_OFFSET_BITS)) >> (64 - TRANSFER_CACHE_OFFSET_BITS);
+
+	return offset == 0 ? NULL : (slab *)((intptr_t)cache + offset);
+}
+
+static uint64_t makeHead(transferCache *cache, uint64_t oldHead, slab *s)
+{
+	uint64_t tag = (oldHead >> TRANSFER_CACHE_OFFSET_BITS) + 1;
+	uint64_t offset = s == NULL ? 0 : ((intptr_t)s - (intptr_t)cache) & TRANSFER_CACHE_OFFSET_MASK;
+
+	return (tag << TRANSFER_CACHE_OFFSET_BITS) | offset;
+}
+
+THROWS err_t initTransferCache(transferCache *cache)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(cache != NULL);
+
+	cache->head = 0;
+	cache->slabCount = 0;
+	cache->minSlabCount = 0;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t transferCachePush(transferCache *cache, slab *first, slab *last, size_t count)
+{
+	err_t err = NO_ERRORCODE;
+	uint64_t head = 0;
+
+	CHECK_NOTRACE_ERRORCODE(cache != NULL, EINVAL);
+	CHECK_NOTRACE_ERRORCODE(first != NULL && last != NULL, EINVAL);
+	CHECK_NOTRACE_ERRORCODE((intptr_t)first - (intptr_t)cache < TRANSFER_CACHE_MAX_DISTANCE &&
+								(intptr_t)cache - (intptr_t)first < TRANSFER_CACHE_MAX_DISTANCE,
+							EINVAL);
+
+	head = atomic_load((_Atomic uint64_t *)&cache->head);
+	do
+	{
+		last->header.nextSlab = getHeadSlab(cache, head);
+	} while (!atomic_compare_exchange_weak((_Atomic uint64_t *)&cache->head, &head, makeHead(cache, head, first)));
+
+	atomic_fetch_add((_Atomic uint64_t *)&cache->slabCount, count);
+
+cleanup:
+	return err;
+}
+
+THROWS err_t transferCachePop(transferCache *cache, slab **s)
+{
+	err_t err = NO_ERRORCODE;
+	uint64_t head = 0;
+	uint64_t slabCount = 0;
+	slab *first = NULL;
+
+	CHECK_NOTRACE_ERRORCODE(cache != NULL, EINVAL);
+	CHECK_NOTRACE_ERRORCODE(s != NULL, EINVAL);
+
+	// the pool memory is never unmapped, so reading the next of a slab someone else already popped(and maybe gave back
+	// to the buddy) is safe, the value can be garbage but the tag will make our compare and swap fail.
+	head = atomic_load((_Atomic uint64_t *)&cache->head);
+	do
+	{
+		first = getHeadSlab(cache, head);
+		if (first == NULL)
+		{
+			break;
+		}
+	} while (!atomic_compare_exchange_weak((_Atomic uint64_t *)&cache->head, &head,
+										   makeHead(cache, head, first->header.nextSlab)));
+
+	if (first != NULL)
+	{
+		slabCount = atomic_fetch_sub((_Atomic uint64_t *)&cache->slabCount, 1) - 1;
+		first->header.nextSlab = NULL;
+
+		// the pages the scavenger released come back on the first touch
+		first->header.isReleased = false;
+
+		// racing another pop can leave the min a bit high, it only makes the scavenger keep a slab more
+		if (slabCount < atomic_load((_Atomic uint64_t *)&cache->minSlabCount))
+		{
+			atomic_store((_Atomic uint64_t *)&cache->minSlabCount, slabCount);
+		}
+	}
+
+	*s = first;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t transferCachePopAll(transferCache *cache, slab **first, slab **last, size_t *count)
+{
+	err_t err = NO_ERRORCODE;
+	uint64_t head = 0;
+
+	QUITE_CHECK(cache != NULL);
+	QUITE_CHECK(first != NULL && last != NULL && count != NULL);
+
+	head = atomic_load((_Atomic uint64_t *)&cache->head);
+	while (!atomic_compare_exchange_weak((_Atomic uint64_t *)&cache->head, &head, makeHead(cache, head, NULL)))
+	{
+	}
+
+	*first = getHeadSlab(cache, head);
+	*last = *first;
+	*count = 0;
+
+	for (slab *s = *first; s != NULL; s = s->header.nextSlab)
+	{
+		*last = s;
+		*count += 1;
+	}
+
+	atomic_fetch_sub((_Atomic uint64_t *)&cache->slabCount, *count);
+
+cleanup:
+	return err;
+}
+
+THROWS err_t transferCacheTakeIdleCount(transferCache *cache, size_t *idleCount)
+{
+	err_t err = NO_ERRORCODE;
+	uint64_t slabCount = 0;
+
+	QUITE_CHECK(cache != NULL);
+	QUITE_CHECK(idleCount != NULL);
+
+	slabCount = atomic_load((_Atomic uint64_t *)&cache->slabCount);
+	*idleCount = MIN(slabCount, atomic_load((_Atomic uint64_t *)&cache->minSlabCount));
+	atomic_store((_Atomic uint64_t *)&cache->minSlabCount, slabCount);
+
+cleanup:
+	return err;
+}
@@ -1,83 +1,556 @@
 #include "allocators/unsafeAllocator.h"
 
 #include "defaultTrace.h"
-#include "os/rseq.h"
 
 #include "err.h"
 
 #include <cstdint>
+#include <immintrin.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <strings.h>
 
-USED_IN_RSEQ
-static long ceil2(double x)
+/**
+ * @brief find the first byte in [start, end) that still has a zero bit in it.
+ * the bitmap is checked 32/16 bytes at a time when we have avx2/sse2, then a word at a time and only the tail is
+ * checked byte by byte.
+ *
+ * @return the index of the byte or end if all of the bytes are full
+ */
+static size_t findFirstNotFullByte(const uint8_t *byteArray, size_t start, size_t end)
 {
-	if ((int64_t)x > INT64_MAX)
-		return (int64_t)x; // big floats are all ints
-	return ((long)(x + (0.99999999999999997)));
+	uint64_t word = 0;
+
+#if defined(__AVX2__)
+	const __m256i fullVector = _mm256_set1_epi8((char)0xFF);
+	for (; start + sizeof(__m256i) <= end; start += sizeof(__m256i))
+	{
+		uint32_t notFullMask = ~(uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&byteArray[start]), fullVector));
+		if (notFullMask != 0)
+		{
+			return start + __builtin_ctz(notFullMask);
+		}
+	}
+#endif
+
+#if defined(__SSE2__)
+	const __m128i fullVector128 = _mm_set1_epi8((char)0xFF);
+	for (; start + sizeof(__m128i) <= end; start += sizeof(__m128i))
+	{
+		uint32_t notFullMask = (~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+								   _mm_loadu_si128((const __m128i *)&byteArray[start]), fullVector128))) &
+							   0xFFFF;
+		if (notFullMask != 0)
+		{
+			return start + __builtin_ctz(notFullMask);
+		}
+	}
+#endif
+
+	for (; start + sizeof(uint64_t) <= end; start += sizeof(uint64_t))
+	{
+		__builtin_memcpy(&word, &byteArray[start], sizeof(uint64_t));
+		if (word != UINT64_MAX)
+		{
+			return start + __builtin_ctzll(~word) / 8;
+		}
+	}
+
+	for (; start < end; start++)
+	{
+		if (byteArray[start] != UINT8_MAX)
+		{
+			return start;
+		}
+	}
+
+	return end;
+}
+
+/**
+ * @brief find a zero bit in the free list, starting at the byte hint and wrapping around to the start.
+ * @note the bits after the last cell are always set(see initSlabFreeList) so any zero bit is a real free cell.
+ *
+ * @return the index of the bit or -1 if the free list is full
+ */
+static int findFirstZeroInByteArray(const uint8_t *byteArray, size_t byteArraySize, size_t hint)
+{
+	size_t byteIndex = 0;
+
+	if (hint >= byteArraySize)
+	{
+		hint = 0;
+	}
+
+	byteIndex = findFirstNotFullByte(byteArray, hint, byteArraySize);
+	if (byteIndex == byteArraySize)
+	{
+		byteIndex = findFirstNotFullByte(byteArray, 0, hint);
+		if (byteIndex == hint)
+		{
+			return -1;
+		}
+	}
+
+	return byteIndex * 8 + __builtin_ctz(~(uint32_t)byteArray[byteIndex]);
+}
+
+int unsafeFindFreeCell(const uint8_t *freeList, size_t freeListSize, size_t hint)
+{
+	return findFirstZeroInByteArray(freeList, freeListSize, hint);
+}
+
+/**
+ * @brief clear the free list of a new slab and set all the bits that don't have a cell behind them.
+ */
+static void initSlabFreeList(slab *s, slabCache *cache)
+{
+	size_t cellCount = defaultSlabLayout::cellCount(cache->cellSize);
+
+	bzero(s->cache, cache->freeListSize);
+	for (size_t i = cellCount; i < cache->freeListSize * 8; i++)
+	{
+		s->cache[i / 8] |= (1 << (i % 8));
+	}
+}
+
+/**
+ * @brief reset the header of a slab that now belongs to cache, the slab free list has to be clear already.
+ * @note nextFreedSlab, nextEmptiedSlab and nextRemoteFreedSlab are written by whoever pushes the slab, and a slab is
+ * only reclaimed once it is off all of those lists(see handleEmptiedSlabs), so they are left alone.
+ */
+static void adoptSlab(slabCache *cache, slab *s)
+{
+	s->header.slabMagic = SLAB_MAGIC;
+	s->header.nextSlab = NULL;
+	s->header.prevSlab = NULL;
+	s->header.owner = cache;
+	s->header.remoteFreeCells.store(NULL);
+	s->header.cellSize = cache->cellSize;
+	s->header.usedCells = 0;
+	s->header.freeListHint = 0;
+	s->header.isSlabFull = false;
+	s->header.isReleased = false;
+	s->header.list = SLAB_DETACHED;
+
+	__atomic_fetch_add(&cache->stats.slabCount, 1, __ATOMIC_RELAXED);
+}
+
+static void pushSlabToList(offsetPtr<slab> *list, slab *s, slabList listId)
+{
+	s->header.prevSlab = NULL;
+	s->header.nextSlab = *list;
+	if (*list != NULL)
+	{
+		(*list)->header.prevSlab = s;
+	}
+
+	*list = s;
+	s->header.list = listId;
+}
+
+static void unlinkSlabFromList(offsetPtr<slab> *list, slab *s)
+{
+	if (s->header.prevSlab != NULL)
+	{
+		s->header.prevSlab->header.nextSlab = s->header.nextSlab;
+	}
+	else
+	{
+		*list = s->header.nextSlab;
+	}
+
+	if (s->header.nextSlab != NULL)
+	{
+		s->header.nextSlab->header.prevSlab = s->header.prevSlab;
+	}
+
+	s->header.prevSlab = NULL;
+	s->header.nextSlab = NULL;
+	s->header.list = SLAB_DETACHED;
+}
+
+static void pushEmptySlab(slabCache *cache, slab *s)
+{
+	slab *head = cache->emptySlabs.load();
+
+	s->header.prevSlab = NULL;
+	s->header.list = SLAB_ON_EMPTY_LIST;
+
+	do
+	{
+		s->header.nextSlab = head;
+	} while (!cache->emptySlabs.compareExchangeWeak(head, s));
+
+	atomic_fetch_add((_Atomic size_t *)&cache->emptySlabCount, 1);
+}
+
+/**
+ * @note only the holder of the cache lock pops from the empty list so there is no ABA here
+ */
+static slab *popEmptySlab(slabCache *cache)
+{
+	slab *head = cache->emptySlabs.load();
+
+	while (head != NULL && !cache->emptySlabs.compareExchangeWeak(head, head->header.nextSlab))
+	{
+	}
+
+	if (head != NULL)
+	{
+		atomic_fetch_sub((_Atomic size_t *)&cache->emptySlabCount, 1);
+		head->header.nextSlab = NULL;
+		head->header.list = SLAB_DETACHED;
+	}
+
+	return head;
+}
+
+/**
+ * @brief if a partial slab has no used cells move it to the empty list.
+ * @note only for slabs taken off emptiedSlabs, see handleEmptiedSlabs.
+ */
+static void moveEmptySlabOffPartialList(slabCache *cache, slab *s)
+{
+	if (s->header.list == SLAB_ON_PARTIAL_LIST && atomic_load((_Atomic uint32_t *)&s->header.usedCells) == 0)
+	{
+		unlinkSlabFromList(&cache->partialSlabs, s);
+		pushEmptySlab(cache, s);
+	}
+}
+
+/**
+ * @brief move the full slabs that had a cell freed back to the partial list.
+ */
+static void handleFreedFullSlabs(slabCache *cache)
+{
+	slab *freedSlab = cache->freedFullSlabs.exchange(NULL);
+	slab *nextFreedSlab = NULL;
+
+	for (; freedSlab != NULL; freedSlab = nextFreedSlab)
+	{
+		nextFreedSlab = freedSlab->header.nextFreedSlab;
+
+		if (freedSlab->header.list == SLAB_ON_FULL_LIST)
+		{
+			unlinkSlabFromList(&cache->fullSlabs, freedSlab);
+			pushSlabToList(&cache->partialSlabs, freedSlab, SLAB_ON_PARTIAL_LIST);
+		}
+	}
 }
 
-USED_IN_RSEQ
-static size_t GET_SLAB_FREE_LIST_SIZE(size_t cellSize)
+/**
+ * @brief move the slabs that had there last cell freed to the empty list, this is the only place a slab is reclaimed.
+ * @note the free that pushed the slab is done with it once it is on emptiedSlabs. a free pushes the slab to
+ * freedFullSlabs before it gives back its cell, so after we saw usedCells at 0 all of those pushes are on the list and
+ * we take them off before the slab can go to another cache.
+ */
+static void handleEmptiedSlabs(slabCache *cache)
 {
-	return ((size_t)ceil2((float)((SLAB_SIZE - sizeof(slabHead)) / cellSize) / 8.0f));
+	slab *emptiedSlab = cache->emptiedSlabs.exchange(NULL);
+	slab *nextEmptiedSlab = NULL;
+	slab *reclaimedSlabs = NULL;
+
+	for (; emptiedSlab != NULL; emptiedSlab = nextEmptiedSlab)
+	{
+		nextEmptiedSlab = emptiedSlab->header.nextEmptiedSlab;
+
+		// once the bit is clear the next free that empties the slab pushes it again, if it is still empty no one can
+		// free on it and we reuse the link
+		if ((atomic_fetch_and((_Atomic uint32_t *)&emptiedSlab->header.usedCells, ~SLAB_EMPTIED_PENDING) &
+			 ~SLAB_EMPTIED_PENDING) == 0)
+		{
+			emptiedSlab->header.nextEmptiedSlab = reclaimedSlabs;
+			reclaimedSlabs = emptiedSlab;
+		}
+	}
+
+	handleFreedFullSlabs(cache);
+
+	for (; reclaimedSlabs != NULL; reclaimedSlabs = nextEmptiedSlab)
+	{
+		nextEmptiedSlab = reclaimedSlabs->header.nextEmptiedSlab;
+		moveEmptySlabOffPartialList(cache, reclaimedSlabs);
+	}
 }
 
-USED_IN_RSEQ
-static size_t GET_SLAB_CELL_INDEX(size_t cellSize, off_t i)
+/**
+ * @brief the last used cell of the slab was freed, give it back to the owner so it can move it to the empty list.
+ */
+static void pushEmptiedSlab(slab *emptiedSlab)
 {
-	return (GET_SLAB_FREE_LIST_SIZE(cellSize) + 1 + (i)*cellSize);
+	slabCache *cache = emptiedSlab->header.owner;
+	slab *head = cache->emptiedSlabs.load();
+
+	do
+	{
+		emptiedSlab->header.nextEmptiedSlab = head;
+	} while (!cache->emptiedSlabs.compareExchangeWeak(head, emptiedSlab));
 }
 
-USED_IN_RSEQ
-static size_t IS_CELL_IN_SLAB(size_t cellSize, off_t i)
+/**
+ * @brief give count cells of the slab back, the one that brings usedCells to 0 sets SLAB_EMPTIED_PENDING with the same
+ * cas and pushes the slab to the owner.
+ */
+static void releaseUsedCells(slab *s, uint32_t count)
 {
-	return (GET_SLAB_CELL_INDEX(cellSize, i) <= SLAB_CACHE_SIZE);
+	uint32_t usedCells = atomic_load((_Atomic uint32_t *)&s->header.usedCells);
+	uint32_t newUsedCells = 0;
+
+	do
+	{
+		newUsedCells = usedCells - count;
+		if ((newUsedCells & ~SLAB_EMPTIED_PENDING) == 0)
+		{
+			newUsedCells |= SLAB_EMPTIED_PENDING;
+		}
+	} while (!atomic_compare_exchange_weak((_Atomic uint32_t *)&s->header.usedCells, &usedCells, newUsedCells));
+
+	if ((usedCells & SLAB_EMPTIED_PENDING) == 0 && (newUsedCells & SLAB_EMPTIED_PENDING) != 0)
+	{
+		pushEmptiedSlab(s);
+	}
 }
 
-USED_IN_RSEQ
-static int8_t findFirstZeroInByte(uint8_t byte)
+/**
+ * @brief clear the bits of all the cells other cores freed on our slabs, each slab list is taken with one exchange.
+ * full slabs that got cells back are moved to the partial list and a slab that has no used cells left goes to
+ * emptiedSlabs.
+ * @note a cell that was freed twice from other cores is on the chain twice, the second push overwrote its link so the
+ * chain goes back to a cell we already cleared. we stop at the first cell that is not an allocated cell of the slab,
+ * the cells after it stay allocated but none of them is given out twice.
+ */
+static void drainRemoteFrees(slabCache *cache)
 {
-	for (int8_t i = 0; i < 8; i++)
+	slab *remoteFreedSlab = cache->remoteFreedSlabs.exchange(NULL);
+	slab *nextRemoteFreedSlab = NULL;
+	size_t cellCount = defaultSlabLayout::cellCount(cache->cellSize);
+	void *cell = NULL;
+	void *nextCell = NULL;
+	size_t cellOffset = 0;
+	size_t cellIndex = 0;
+	uint8_t cellBit = 0;
+	uint32_t freedCells = 0;
+	bool expected = true;
+
+	for (; remoteFreedSlab != NULL; remoteFreedSlab = nextRemoteFreedSlab)
 	{
-		if ((byte & (1 << i)) == 0)
+		// once the cells are taken another core can push the slab again, so read the link first
+		nextRemoteFreedSlab = remoteFreedSlab->header.nextRemoteFreedSlab;
+		cell = remoteFreedSlab->header.remoteFreeCells.exchange(NULL);
+		freedCells = 0;
+
+		for (; cell != NULL && freedCells < cellCount; cell = nextCell)
+		{
+			cellOffset = (size_t)cell - (size_t)&remoteFreedSlab->cache[cache->firstCellOffset];
+			cellIndex = defaultSlabLayout::cellIndex(cellOffset, cache->cellSizeReciprocal);
+			if ((size_t)cell < (size_t)&remoteFreedSlab->cache[cache->firstCellOffset] || cellIndex >= cellCount ||
+				cellIndex * cache->cellSize != cellOffset)
+			{
+				break;
+			}
+
+			// once the bit is clear the cell is not ours to read
+			nextCell = *(offsetPtr<void> *)cell;
+			cellBit = 1 << (cellIndex % 8);
+			if ((atomic_fetch_and((_Atomic uint8_t *)&remoteFreedSlab->cache[cellIndex / 8], (uint8_t)~cellBit) &
+				 cellBit) == 0)
+			{
+				break;
+			}
+
+			if (cellIndex / 8 < remoteFreedSlab->header.freeListHint)
+			{
+				remoteFreedSlab->header.freeListHint = cellIndex / 8;
+			}
+			freedCells++;
+		}
+
+		expected = true;
+		if (atomic_compare_exchange_strong((_Atomic bool *)&remoteFreedSlab->header.isSlabFull, &expected, false))
 		{
-			return i;
+			unlinkSlabFromList(&cache->fullSlabs, remoteFreedSlab);
+			pushSlabToList(&cache->partialSlabs, remoteFreedSlab, SLAB_ON_PARTIAL_LIST);
 		}
+
+		releaseUsedCells(remoteFreedSlab, freedCells);
 	}
-	return -1;
 }
 
-USED_IN_RSEQ
-static int findFirstZeroInByteArray(uint8_t *byteArray, size_t byteArraySize)
+/**
+ * @brief give the empty slabs above the low watermark to the transfer cache with one push, so an other core can use
+ * them instead of going to the buddy.
+ */
+THROWS static err_t releaseSurplusSlabs(slabCache *cache)
 {
-	int8_t emptyBitIndex = -1;
+	err_t err = NO_ERRORCODE;
+	slab *first = NULL;
+	slab *last = NULL;
+	slab *surplusSlab = NULL;
+	size_t count = 0;
+
+	if (cache->centralCache == NULL ||
+		atomic_load((_Atomic size_t *)&cache->emptySlabCount) <= SLAB_CACHE_EMPTY_HIGH_WATERMARK)
+	{
+		goto cleanup;
+	}
 
-	for (size_t i = 0; i < byteArraySize; i++)
+	while (atomic_load((_Atomic size_t *)&cache->emptySlabCount) > SLAB_CACHE_EMPTY_LOW_WATERMARK &&
+		   (surplusSlab = popEmptySlab(cache)) != NULL)
 	{
-		if (byteArray[i] != 255)
+		surplusSlab->header.nextSlab = first;
+		if (first == NULL)
 		{
-			emptyBitIndex = findFirstZeroInByte(byteArray[i]);
+			last = surplusSlab;
 		}
+		first = surplusSlab;
+		count++;
+	}
+
+	if (first != NULL)
+	{
+		QUITE_RETHROW(transferCachePush(cache->centralCache, first, last, count));
+		__atomic_fetch_sub(&cache->stats.slabCount, count, __ATOMIC_RELAXED);
+	}
 
-		if (emptyBitIndex != -1)
+cleanup:
+	return err;
+}
+
+/**
+ * @brief move the full slabs that had a cell freed, the cells freed by other cores and then an empty slab to the
+ * partial list, if there is no empty slab we take one from the transfer cache.
+ *
+ * @return ENOMEM if there is no slab on the partial list after all of that.
+ */
+THROWS static err_t refillPartialSlabs(slabCache *cache)
+{
+	err_t err = NO_ERRORCODE;
+	slab *newSlab = NULL;
+
+	handleFreedFullSlabs(cache);
+	drainRemoteFrees(cache);
+	handleEmptiedSlabs(cache);
+	QUITE_RETHROW(releaseSurplusSlabs(cache));
+
+	if (cache->partialSlabs != NULL)
+	{
+		goto cleanup;
+	}
+
+	newSlab = popEmptySlab(cache);
+	if (newSlab == NULL && cache->centralCache != NULL)
+	{
+		QUITE_RETHROW(transferCachePop(cache->centralCache, &newSlab));
+		if (newSlab != NULL)
 		{
-			return emptyBitIndex + i * 8;
+			adoptSlab(cache, newSlab);
 		}
 	}
 
-	return -1;
+	CHECK_NOTRACE_ERRORCODE(newSlab != NULL, ENOMEM);
+	pushSlabToList(&cache->partialSlabs, newSlab, SLAB_ON_PARTIAL_LIST);
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief move a partial slab to the full list.
+ * @note a free can race us between the search and the isSlabFull store, so we look again after the store and take the
+ * slab back if no one else did.
+ */
+static void moveSlabToFullList(slabCache *cache, slab *fullSlab, size_t freeListSize)
+{
+	bool expected = true;
+
+	unlinkSlabFromList(&cache->partialSlabs, fullSlab);
+	pushSlabToList(&cache->fullSlabs, fullSlab, SLAB_ON_FULL_LIST);
+
+	atomic_store((_Atomic bool *)&fullSlab->header.isSlabFull, true);
+
+	if (findFirstZeroInByteArray(fullSlab->cache, freeListSize, 0) != -1 &&
+		atomic_compare_exchange_strong((_Atomic bool *)&fullSlab->header.isSlabFull, &expected, false))
+	{
+		unlinkSlabFromList(&cache->fullSlabs, fullSlab);
+		pushSlabToList(&cache->partialSlabs, fullSlab, SLAB_ON_PARTIAL_LIST);
+	}
+}
+
+/**
+ * @brief a cell was freed on a full slab, give it back to the owner so it can move it to the partial list.
+ */
+static void pushFreedFullSlab(slab *freedSlab)
+{
+	slabCache *cache = freedSlab->header.owner;
+	slab *head = cache->freedFullSlabs.load();
+
+	do
+	{
+		freedSlab->header.nextFreedSlab = head;
+	} while (!cache->freedFullSlabs.compareExchangeWeak(head, freedSlab));
+}
+
+/**
+ * @brief push a chain of cells(linked through an offsetPtr in there first word) freed from another core to the slab,
+ * the first chain also gives the slab to the owner.
+ */
+static void pushRemoteFreeCells(slab *s, void *first, void *last)
+{
+	slabCache *cache = s->header.owner;
+	void *head = s->header.remoteFreeCells.load();
+	slab *slabsHead = NULL;
+
+	do
+	{
+		*(offsetPtr<void> *)last = head;
+	} while (!s->header.remoteFreeCells.compareExchangeWeak(head, first));
+
+	if (head != NULL)
+	{
+		return;
+	}
+
+	slabsHead = cache->remoteFreedSlabs.load();
+	do
+	{
+		s->header.nextRemoteFreedSlab = slabsHead;
+	} while (!cache->remoteFreedSlabs.compareExchangeWeak(slabsHead, s));
 }
 
-bool isInRseq = false;
+static void pushRemoteFreeCell(slab *s, void *cell)
+{
+	pushRemoteFreeCells(s, cell, cell);
+}
 
-USED_IN_RSEQ THROWS static err_t unsafeAlloc(void **const ptr, const size_t count, const size_t size,
-											 [[maybe_unused]] allocatorFlags flags, void *firstSlab)
+/**
+ * @brief a free is remote if this thread is not the owner of the cache right now, the id is read from rseq so it is
+ * the same one the allocation used.
+ */
+static bool isRemoteFree(const slabCache *cache)
+{
+	if (cache->ownerId == NO_SLAB_CACHE_OWNER)
+	{
+		return false;
+	}
+
+	if (cache->ownerKind == SLAB_CACHE_OWNER_THREAD)
+	{
+		return cache->ownerId != currentThreadCacheId;
+	}
+
+	return cache->ownerId != rseqGetId(getSlabCacheIdKind(cache));
+}
+
+thread_local uint32_t currentThreadCacheId = NO_SLAB_CACHE_OWNER;
+
+THROWS err_t unsafeAlloc(void **const ptr, const size_t count, const size_t size,
+						 [[maybe_unused]] allocatorFlags flags, void *slabCacheData)
 {
 	err_t err = NO_ERRORCODE;
-	slab *slabContent = (slab *)firstSlab;
-	slab *currentSlab = slabContent;
+	slabCache *cache = (slabCache *)slabCacheData;
+	slab *currentSlab = NULL;
 	int freeIndex = -1;
 	size_t freeListSize = 0;
 	int i = 0;
@@ -85,57 +558,180 @@ USED_IN_RSEQ THROWS static err_t unsafeAlloc(void **const ptr, const size_t coun
 	CHECK_NOTRACE_ERRORCODE(ptr != NULL, 0)
 	CHECK_NOTRACE_ERRORCODE(count > 0 && size > 0, 0);
 	CHECK_NOTRACE_ERRORCODE(*ptr == NULL, 0);
-	CHECK_NOTRACE_ERRORCODE(firstSlab != NULL, 0);
-	CHECK_NOTRACE_ERRORCODE(slabContent->header.slabMagic == SLAB_MAGIC, 0);
-	CHECK_NOTRACE_ERRORCODE(slabContent->header.cellSize >= size * count, 0);
-	freeListSize = GET_SLAB_FREE_LIST_SIZE(slabContent->header.cellSize);
+	CHECK_NOTRACE_ERRORCODE(cache != NULL, 0);
+	CHECK_NOTRACE_ERRORCODE(cache->cellSize >= size * count, 0);
+	freeListSize = cache->freeListSize;
 
-	if(r.rseq_cs != 0)
-	{	
-		((rseq_cs*)r.rseq_cs)->post_commit_offset = (uint64_t)&&post_commit_offset - ((rseq_cs*)r.rseq_cs)->start_ip;
+	if (cache->emptiedSlabs.load() != NULL)
+	{
+		handleEmptiedSlabs(cache);
+		RETHROW_NOTRACE(releaseSurplusSlabs(cache));
 	}
 
-	do
+	while (*ptr == NULL)
 	{
 		CHECK_NOTRACE_ERRORCODE(i < 1000000, 0);
-		if (currentSlab->header.isSlabFull == false)
+		i += 1;
+
+		currentSlab = cache->partialSlabs;
+		if (currentSlab == NULL)
 		{
-			freeIndex = findFirstZeroInByteArray(currentSlab->cache, freeListSize);
-			if (freeIndex != -1 && IS_CELL_IN_SLAB(currentSlab->header.cellSize, freeIndex + 1))
-			{
-	//todo: this might be a bug(|= is not atomic opration, free can change this value)
-				// currentSlab->cache[freeIndex / 8] |= (1 << (freeIndex % 8));
-				atomic_fetch_or((_Atomic uint8_t *)&currentSlab->cache[freeIndex / 8], (1 << (freeIndex % 8)));
-post_commit_offset:
-				*ptr = (void *)&currentSlab->cache[GET_SLAB_CELL_INDEX(currentSlab->header.cellSize, freeIndex)];
+			RETHROW_NOTRACE(refillPartialSlabs(cache));
+			continue;
+		}
 
-			}
-			else
+		CHECK_NOTRACE_ERRORCODE(currentSlab->header.slabMagic == SLAB_MAGIC, 0);
+
+		// a free can't set a bit, so if the bit is already set we just raced another allocation on this slab and we
+		// need to search again
+		do
+		{
+			freeIndex = findFirstZeroInByteArray(currentSlab->cache, freeListSize, currentSlab->header.freeListHint);
+		} while (freeIndex != -1 &&
+				 (atomic_fetch_or((_Atomic uint8_t *)&currentSlab->cache[freeIndex / 8], (1 << (freeIndex % 8))) &
+				  (1 << (freeIndex % 8))) != 0);
+
+		if (freeIndex != -1)
+		{
+			atomic_fetch_add((_Atomic uint32_t *)&currentSlab->header.usedCells, 1);
+			__atomic_fetch_add(&cache->stats.slabAllocs, 1, __ATOMIC_RELAXED);
+			currentSlab->header.freeListHint = freeIndex / 8;
+			*ptr = (void *)&currentSlab->cache[cache->firstCellOffset + freeIndex * cache->cellSize];
+		}
+		else
+		{
+			moveSlabToFullList(cache, currentSlab, freeListSize);
+		}
+	}
+
+	CHECK_NOTRACE_ERRORCODE((size_t)*ptr + cache->cellSize <= (size_t)currentSlab + SLAB_SIZE, 0);
+	CHECK_NOTRACE_ERRORCODE((size_t)*ptr > (size_t)&currentSlab->cache[freeListSize], 0);
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief find a byte in the slab free list with a zero bit and pick up to count of its free cells.
+ * @return the bits of the cells, 0 if the slab is full(byteIndex is freeListSize)
+ */
+static uint8_t findFreeCellsInByte(slab *s, size_t freeListSize, size_t count, size_t *byteIndex)
+{
+	uint8_t freeBits = 0;
+	uint8_t wantedBits = 0;
+	size_t hint = s->header.freeListHint < freeListSize ? s->header.freeListHint : 0;
+
+	*byteIndex = findFirstNotFullByte(s->cache, hint, freeListSize);
+	if (*byteIndex == freeListSize)
+	{
+		*byteIndex = findFirstNotFullByte(s->cache, 0, hint);
+		if (*byteIndex == hint)
+		{
+			*byteIndex = freeListSize;
+			return 0;
+		}
+	}
+
+	// take the lowest free bits, at most count of them
+	freeBits = ~s->cache[*byteIndex];
+	for (size_t i = 0; i < count && freeBits != 0; i++)
+	{
+		wantedBits |= freeBits & (~freeBits + 1);
+		freeBits &= freeBits - 1;
+	}
+
+	return wantedBits;
+}
+
+THROWS err_t unsafeAllocBatch(void **const ptrs, const size_t count, size_t *allocatedCount, void *slabCacheData)
+{
+	err_t err = NO_ERRORCODE;
+	slabCache *cache = (slabCache *)slabCacheData;
+	slab *currentSlab = NULL;
+	size_t byteIndex = 0;
+	size_t cellIndex = 0;
+	uint8_t wantedBits = 0;
+	uint8_t claimedBits = 0;
+	int i = 0;
+
+	CHECK_NOTRACE_ERRORCODE(ptrs != NULL, 0);
+	CHECK_NOTRACE_ERRORCODE(allocatedCount != NULL, 0);
+	CHECK_NOTRACE_ERRORCODE(*allocatedCount <= count, 0);
+	CHECK_NOTRACE_ERRORCODE(cache != NULL, 0);
+
+	if (cache->emptiedSlabs.load() != NULL)
+	{
+		handleEmptiedSlabs(cache);
+		RETHROW_NOTRACE(releaseSurplusSlabs(cache));
+	}
+
+	while (*allocatedCount < count)
+	{
+		CHECK_NOTRACE_ERRORCODE(i < 1000000, 0);
+		i += 1;
+
+		currentSlab = cache->partialSlabs;
+		if (currentSlab == NULL)
+		{
+			RETHROW_NOTRACE(refillPartialSlabs(cache));
+			continue;
+		}
+
+		CHECK_NOTRACE_ERRORCODE(currentSlab->header.slabMagic == SLAB_MAGIC, 0);
+
+		wantedBits = findFreeCellsInByte(currentSlab, cache->freeListSize, count - *allocatedCount, &byteIndex);
+		if (wantedBits != 0)
+		{
+			// frees clear bits of the byte while we hold it, so the claim is one atomic or and a bit that is already set
+			// is skipped
+			claimedBits = wantedBits & ~atomic_fetch_or((_Atomic uint8_t *)&currentSlab->cache[byteIndex], wantedBits);
+			atomic_fetch_add((_Atomic uint32_t *)&currentSlab->header.usedCells, __builtin_popcount(claimedBits));
+			__atomic_fetch_add(&cache->stats.slabAllocs, __builtin_popcount(claimedBits), __ATOMIC_RELAXED);
+			currentSlab->header.freeListHint = byteIndex;
+
+			for (; claimedBits != 0; claimedBits &= claimedBits - 1)
 			{
-				currentSlab->header.isSlabFull = true;
+				cellIndex = byteIndex * 8 + __builtin_ctz(claimedBits);
+				ptrs[*allocatedCount] = (void *)&currentSlab->cache[cache->firstCellOffset + cellIndex * cache->cellSize];
+				*allocatedCount += 1;
 			}
 		}
-		i += 1;
-	} while (*ptr == NULL && (currentSlab = currentSlab->header.nextSlab) != NULL);
+		else if (byteIndex == cache->freeListSize)
+		{
+			moveSlabToFullList(cache, currentSlab, cache->freeListSize);
+		}
+	}
 
-	CHECK_NOTRACE_ERRORCODE(*ptr != NULL, ENOMEM);
-	CHECK_NOTRACE_ERRORCODE((size_t)*ptr + slabContent->header.cellSize < (size_t)currentSlab + SLAB_SIZE, 0);
-	CHECK_NOTRACE_ERRORCODE((size_t)*ptr > (size_t)&currentSlab->cache[freeListSize], 0);
+cleanup:
+	return err;
+}
+
+THROWS err_t unsafeAlignedAlloc(void **const ptr, const size_t count, const size_t size, const size_t alignment,
+								allocatorFlags flags, void *slabCacheData)
+{
+	err_t err = NO_ERRORCODE;
+	slabCache *cache = (slabCache *)slabCacheData;
+
+	QUITE_CHECK(cache != NULL);
+	QUITE_CHECK(alignment > 0 && (alignment & (alignment - 1)) == 0);
+	CHECK_NOTRACE_ERRORCODE(defaultSlabLayout::cellAlignment(cache->cellSize) >= alignment, EINVAL);
+
+	QUITE_RETHROW(unsafeAlloc(ptr, count, size, flags, slabCacheData));
 
 cleanup:
 	return err;
 }
 
 THROWS err_t unsafeRealloc(void **const ptr, const size_t count, const size_t size,
-						   [[maybe_unused]] allocatorFlags flags, void *firstSlab)
+						   [[maybe_unused]] allocatorFlags flags, void *slabData)
 {
 	err_t err = NO_ERRORCODE;
-	slab *slabContent = (slab *)firstSlab;
+	slab *slabContent = (slab *)slabData;
 
 	QUITE_CHECK(ptr != NULL);
 	QUITE_CHECK(*ptr != NULL);
 	QUITE_CHECK(count > 0 && size > 0);
-	QUITE_CHECK(firstSlab != NULL);
+	QUITE_CHECK(slabData != NULL);
 	QUITE_CHECK(slabContent->header.slabMagic == SLAB_MAGIC);
 
 	CHECK_NOTRACE_ERRORCODE(slabContent->header.cellSize >= count * size, E2BIG);
@@ -144,95 +740,262 @@ cleanup:
 	return err;
 }
 
-THROWS err_t unsafeDealloc(void **const ptr, void *data)
+/**
+ * @brief the index of the cell ptr points to, fails if ptr is not the start of an allocated cell of s.
+ */
+THROWS static err_t getAllocatedCellIndex(const void *ptr, slab *s, size_t *cellIndex)
 {
 	err_t err = NO_ERRORCODE;
 	size_t cellOffset = 0;
-	size_t cellIndex = 0;
-
-	volatile slab *s = (slab *)data;
+	slabCache *cache = NULL;
 
 	QUITE_CHECK(ptr != NULL);
-	QUITE_CHECK(*ptr != NULL);
 	QUITE_CHECK(s != NULL);
 
 	QUITE_CHECK(s->header.slabMagic == SLAB_MAGIC);
 	QUITE_CHECK(s->header.cellSize > 0);
+	QUITE_CHECK(s->header.owner != NULL);
+	cache = s->header.owner;
 
-	QUITE_CHECK((size_t)*ptr >= (size_t)&s->cache[GET_SLAB_CELL_INDEX(s->header.cellSize, 0)])
-	QUITE_CHECK((size_t)*ptr < (size_t)&s->cache[SLAB_CACHE_SIZE])
+	QUITE_CHECK((size_t)ptr >= (size_t)&s->cache[cache->firstCellOffset])
+	QUITE_CHECK((size_t)ptr < (size_t)&s->cache[SLAB_CACHE_SIZE])
 
-	cellOffset = ((size_t)*ptr - (size_t)&s->cache[GET_SLAB_CELL_INDEX(s->header.cellSize, 0)]);
-	QUITE_CHECK(cellOffset % s->header.cellSize == 0);
-	QUITE_CHECK(cellOffset <= SLAB_CACHE_SIZE)
-	cellIndex = cellOffset / s->header.cellSize;
+	cellOffset = ((size_t)ptr - (size_t)&s->cache[cache->firstCellOffset]);
+	*cellIndex = defaultSlabLayout::cellIndex(cellOffset, cache->cellSizeReciprocal);
+	QUITE_CHECK(*cellIndex * cache->cellSize == cellOffset);
 
-	QUITE_CHECK(&s->cache[GET_SLAB_CELL_INDEX(s->header.cellSize, cellIndex)] == *ptr);
-	QUITE_CHECK((s->cache[cellIndex] | (1 << (cellIndex % 8))) > 0);
+	QUITE_CHECK((s->cache[*cellIndex / 8] & (1 << (*cellIndex % 8))) != 0);
 
-	//todo: this might be a bug(&= is not atomic opration)
-	atomic_fetch_and((_Atomic uint8_t *)&s->cache[cellIndex / 8], ~(1 << (cellIndex % 8)));
-	s->header.isSlabFull = false;
+cleanup:
+	return err;
+}
 
-	*ptr = NULL;
+THROWS err_t unsafeCheckCell(const void *ptr, void *slabData)
+{
+	err_t err = NO_ERRORCODE;
+	size_t cellIndex = 0;
+
+	QUITE_RETHROW(getAllocatedCellIndex(ptr, (slab *)slabData, &cellIndex));
 
 cleanup:
 	return err;
 }
 
-err_t createUnsafeAllocator(memoryAllocator *res, slab *firstSlab, size_t cellSize)
+THROWS err_t unsafeDealloc(void **const ptr, void *slabData)
 {
 	err_t err = NO_ERRORCODE;
-	size_t freeListSize = 0;
+	size_t cellIndex = 0;
+	bool expected = true;
 
-	QUITE_CHECK(res != nullptr);
-	QUITE_CHECK(firstSlab != nullptr)
+	slab *s = (slab *)slabData;
+	slabCache *cache = NULL;
 
-	res->alloc = unsafeAlloc;
-	res->realloc = unsafeRealloc;
-	res->free = unsafeDealloc;
-	res->data = firstSlab;
+	QUITE_CHECK(ptr != NULL);
+	QUITE_RETHROW(getAllocatedCellIndex(*ptr, s, &cellIndex));
+	cache = s->header.owner;
 
-	firstSlab->header.nextSlab = nullptr;
-	firstSlab->header.slabMagic = SLAB_MAGIC;
-	firstSlab->header.cellSize = cellSize;
+	if (isRemoteFree(cache))
+	{
+		pushRemoteFreeCell(s, *ptr);
+		__atomic_fetch_add(&cache->stats.remoteFrees, 1, __ATOMIC_RELAXED);
+		*ptr = NULL;
+		goto cleanup;
+	}
 
-	freeListSize = GET_SLAB_FREE_LIST_SIZE(cellSize);
+	// the bit was checked above, if it is clear now another free of the same cell raced us and gave it back already
+	QUITE_CHECK((atomic_fetch_and((_Atomic uint8_t *)&s->cache[cellIndex / 8], ~(1 << (cellIndex % 8))) &
+				 (1 << (cellIndex % 8))) != 0);
+	__atomic_fetch_add(&cache->stats.slabFrees, 1, __ATOMIC_RELAXED);
 
-	for (size_t i = 0; i < freeListSize; i++)
+	if (cellIndex / 8 < s->header.freeListHint)
 	{
-		firstSlab->cache[i] = 0;
+		s->header.freeListHint = cellIndex / 8;
 	}
 
+	// only the free that flip the slab back from full gives it to the owner, so it is pushed once
+	if (atomic_compare_exchange_strong((_Atomic bool *)&s->header.isSlabFull, &expected, false))
+	{
+		pushFreedFullSlab(s);
+	}
+
+	releaseUsedCells(s, 1);
+
+	*ptr = NULL;
+
 cleanup:
 	return err;
 }
 
-err_t appendSlab(memoryAllocator *unsafeAllocator, slab *newSlab)
+THROWS err_t unsafeDeallocSized(void **const ptr, const size_t size, void *slabData)
 {
 	err_t err = NO_ERRORCODE;
 
-	size_t freeListSize = 0;
-	slab *firstSlab = NULL;
+	QUITE_CHECK(slabData != NULL);
+	QUITE_CHECK(size > 0 && size <= ((slab *)slabData)->header.cellSize);
+	QUITE_RETHROW(unsafeDealloc(ptr, slabData));
 
-	QUITE_CHECK(unsafeAllocator != NULL);
-	QUITE_CHECK(newSlab != NULL);
+cleanup:
+	return err;
+}
 
-	firstSlab = (slab *)unsafeAllocator->data;
+THROWS err_t unsafeDeallocBatch(void **const ptrs, const size_t count, void *slabData)
+{
+	err_t err = NO_ERRORCODE;
+	size_t cellOffset = 0;
+	size_t cellIndex = 0;
+	size_t pendingByte = SIZE_MAX;
+	uint8_t pendingBits = 0;
+	uint32_t freedCells = 0;
+	bool expected = true;
 
-	QUITE_CHECK(firstSlab != NULL);
+	slab *s = (slab *)slabData;
+	slabCache *cache = NULL;
 
-	newSlab->header.nextSlab = nullptr;
-	newSlab->header.slabMagic = SLAB_MAGIC;
-	newSlab->header.cellSize = firstSlab->header.cellSize;
+	QUITE_CHECK(ptrs != NULL);
+	QUITE_CHECK(count > 0);
+	QUITE_CHECK(s != NULL);
 
-	freeListSize = GET_SLAB_FREE_LIST_SIZE(firstSlab->header.cellSize);
-	bzero(newSlab->cache, freeListSize);
+	QUITE_CHECK(s->header.slabMagic == SLAB_MAGIC);
+	QUITE_CHECK(s->header.owner != NULL);
+	cache = s->header.owner;
 
-	do
+	// check all the cells before we change anything, so a bad pointer doesn't leave half of the batch freed
+	for (size_t i = 0; i < count; i++)
+	{
+		QUITE_CHECK(ptrs[i] != NULL);
+		QUITE_CHECK(i == 0 || ptrs[i] != ptrs[i - 1]);
+		QUITE_CHECK((size_t)ptrs[i] >= (size_t)&s->cache[cache->firstCellOffset]);
+		QUITE_CHECK((size_t)ptrs[i] < (size_t)&s->cache[SLAB_CACHE_SIZE]);
+
+		cellOffset = (size_t)ptrs[i] - (size_t)&s->cache[cache->firstCellOffset];
+		cellIndex = defaultSlabLayout::cellIndex(cellOffset, cache->cellSizeReciprocal);
+		QUITE_CHECK(cellIndex * cache->cellSize == cellOffset);
+		QUITE_CHECK((s->cache[cellIndex / 8] & (1 << (cellIndex % 8))) != 0);
+	}
+
+	if (isRemoteFree(cache))
+	{
+		// chain the cells and push them with one cas
+		for (size_t i = 0; i + 1 < count; i++)
+		{
+			*(offsetPtr<void> *)ptrs[i] = ptrs[i + 1];
+		}
+
+		pushRemoteFreeCells(s, ptrs[0], ptrs[count - 1]);
+		__atomic_fetch_add(&cache->stats.remoteFrees, count, __ATOMIC_RELAXED);
+		goto cleanup;
+	}
+
+	// clear the bits of the cells that share a byte of the free list with one atomic and, a bit that is already clear is
+	// a cell that is twice in ptrs or that another free gave back meanwhile and it is not counted again
+	for (size_t i = 0; i <= count; i++)
+	{
+		if (i < count)
+		{
+			cellOffset = (size_t)ptrs[i] - (size_t)&s->cache[cache->firstCellOffset];
+			cellIndex = defaultSlabLayout::cellIndex(cellOffset, cache->cellSizeReciprocal);
+		}
+
+		if (pendingBits != 0 && (i == count || cellIndex / 8 != pendingByte))
+		{
+			freedCells += __builtin_popcount(
+				atomic_fetch_and((_Atomic uint8_t *)&s->cache[pendingByte], (uint8_t)~pendingBits) & pendingBits);
+			if (pendingByte < s->header.freeListHint)
+			{
+				s->header.freeListHint = pendingByte;
+			}
+
+			pendingBits = 0;
+		}
+
+		if (i < count)
+		{
+			pendingByte = cellIndex / 8;
+			pendingBits |= 1 << (cellIndex % 8);
+		}
+	}
+
+	if (atomic_compare_exchange_strong((_Atomic bool *)&s->header.isSlabFull, &expected, false))
+	{
+		pushFreedFullSlab(s);
+	}
+
+	if (freedCells > 0)
 	{
-		newSlab->header.nextSlab = (slab *)unsafeAllocator->data;
-	} while (!atomic_compare_exchange_weak((void *_Atomic *)&unsafeAllocator->data, (void **)&firstSlab, newSlab));
+		__atomic_fetch_add(&cache->stats.slabFrees, freedCells, __ATOMIC_RELAXED);
+		releaseUsedCells(s, freedCells);
+	}
+
+	QUITE_CHECK(freedCells == count);
+
+cleanup:
+	return err;
+}
+
+err_t initSlabCache(slabCache *cache, size_t cellSize, uint32_t ownerId, slabCacheOwnerKind ownerKind,
+					transferCache *centralCache)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(cache != nullptr);
+	// a cell freed from another core holds the link of remoteFreeCells
+	QUITE_CHECK(cellSize >= sizeof(offsetPtr<void>));
+	QUITE_CHECK(defaultSlabLayout::cellCount(cellSize) > 0);
+
+	QUITE_RETHROW(initFutexLock(&cache->lock));
+	cache->partialSlabs = nullptr;
+	cache->fullSlabs = nullptr;
+	cache->emptySlabs.store(nullptr);
+	cache->emptySlabCount = 0;
+	cache->freedFullSlabs.store(nullptr);
+	cache->emptiedSlabs.store(nullptr);
+	cache->remoteFreedSlabs.store(nullptr);
+	cache->centralCache = centralCache;
+	cache->freeListSize = defaultSlabLayout::freeListSize(cellSize);
+	cache->firstCellOffset = defaultSlabLayout::firstCellOffset(cellSize);
+	cache->cellSizeReciprocal = defaultSlabLayout::cellSizeReciprocal(cellSize);
+	cache->cellSize = cellSize;
+	cache->ownerId = ownerId;
+	cache->ownerKind = ownerKind;
+	cache->fastCellsState = 0;
+	cache->fastCellsCapacity = getFastCellsCapacity(cellSize);
+	bzero(&cache->stats, sizeof(cache->stats));
+
+cleanup:
+	return err;
+}
+
+err_t createUnsafeAllocator(memoryAllocator *res, slabCache *cache, slab *firstSlab, size_t cellSize)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(res != nullptr);
+	QUITE_CHECK(firstSlab != nullptr)
+
+	res->alloc = unsafeAlloc;
+	res->realloc = unsafeRealloc;
+	res->free = unsafeDealloc;
+	res->freeSized = unsafeDeallocSized;
+	res->alignedAlloc = unsafeAlignedAlloc;
+	res->data = cache;
+
+	QUITE_RETHROW(initSlabCache(cache, cellSize, NO_SLAB_CACHE_OWNER, SLAB_CACHE_OWNER_CPU, nullptr));
+	QUITE_RETHROW(appendSlab(cache, firstSlab));
+
+cleanup:
+	return err;
+}
+
+err_t appendSlab(slabCache *cache, slab *newSlab)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(cache != NULL);
+	QUITE_CHECK(newSlab != NULL);
+
+	initSlabFreeList(newSlab, cache);
+	adoptSlab(cache, newSlab);
+	pushEmptySlab(cache, newSlab);
 
 cleanup:
 	return err;
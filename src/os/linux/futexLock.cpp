@@ -0,0 +1,106 @@
+#ifdef __linux__
+
+#include "os/futexLock.h"
+
+#include "defaultTrace.h"
+
+#include "err.h"
+
+#include <cerrno>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static constexpr const uint32_t FUTEX_LOCK_UNLOCKED = 0;
+static constexpr const uint32_t FUTEX_LOCK_LOCKED = 1;
+static constexpr const uint32_t FUTEX_LOCK_CONTENDED = 2;
+
+// we don't use FUTEX_PRIVATE_FLAG as the lock can be in the shared memory and be waited on from other processes.
+THROWS static err_t futexWait(uint32_t *addr, uint32_t expected)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(syscall(SYS_futex, addr, FUTEX_WAIT, expected, NULL, NULL, 0) == 0 || errno == EAGAIN ||
+				errno == EINTR);
+
+cleanup:
+	return err;
+}
+
+THROWS static err_t futexWake(uint32_t *addr, int count)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0) >= 0);
+
+cleanup:
+	return err;
+}
+
+THROWS err_t initFutexLock(futexLock *lock)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(lock != NULL);
+
+	atomic_store((_Atomic uint32_t *)&lock->state, FUTEX_LOCK_UNLOCKED);
+	atomic_store((_Atomic uint32_t *)&lock->waits, 0);
+
+cleanup:
+	return err;
+}
+
+THROWS err_t futexLockAcquire(futexLock *lock)
+{
+	err_t err = NO_ERRORCODE;
+	uint32_t state = FUTEX_LOCK_UNLOCKED;
+
+	QUITE_CHECK(lock != NULL);
+
+	for (size_t i = 0; i < FUTEX_LOCK_SPIN_COUNT; i++)
+	{
+		state = FUTEX_LOCK_UNLOCKED;
+		if (atomic_compare_exchange_weak((_Atomic uint32_t *)&lock->state, &state, FUTEX_LOCK_LOCKED))
+		{
+			goto cleanup;
+		}
+
+		if (state == FUTEX_LOCK_CONTENDED)
+		{
+			break;
+		}
+
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	// from here on we can't know if there are other waiters so we always mark the lock as contended
+	while (atomic_exchange((_Atomic uint32_t *)&lock->state, FUTEX_LOCK_CONTENDED) != FUTEX_LOCK_UNLOCKED)
+	{
+		atomic_fetch_add((_Atomic uint32_t *)&lock->waits, 1);
+		QUITE_RETHROW(futexWait(&lock->state, FUTEX_LOCK_CONTENDED));
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS err_t futexLockRelease(futexLock *lock)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(lock != NULL);
+
+	if (atomic_fetch_sub((_Atomic uint32_t *)&lock->state, 1) != FUTEX_LOCK_LOCKED)
+	{
+		atomic_store((_Atomic uint32_t *)&lock->state, FUTEX_LOCK_UNLOCKED);
+		QUITE_RETHROW(futexWake(&lock->state, 1));
+	}
+
+cleanup:
+	return err;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifdef __linux__
+
+#include "os/numa.h"
+
+#include "defaultTrace.h"
+
+#include "err.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * @brief if a path that we format exists, sysfs has a directory for every node and a link to its node in every cpu.
+ */
+static bool isSysfsPathExists(const char *fmt, uint32_t first, uint32_t second)
+{
+	char path[PATH_MAX] = {0};
+
+	if (snprintf(path, sizeof(path), fmt, first, second) <= 0)
+	{
+		return false;
+	}
+
+	return access(path, F_OK) == 0;
+}
+
+THROWS err_t getNumaNodeCount(uint32_t *nodeCount)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(nodeCount != NULL);
+
+	// node numbers can have holes(an offline node), so the count is the highest node + 1
+	*nodeCount = 1;
+	for (uint32_t node = 1; node < NUMA_MAX_NODES; node++)
+	{
+		if (isSysfsPathExists("/sys/devices/system/node/node%u", node, 0))
+		{
+			*nodeCount = node + 1;
+		}
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS err_t getCpuNumaNode(uint32_t cpu, uint32_t nodeCount, uint32_t *node)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(node != NULL);
+	QUITE_CHECK(nodeCount > 0 && nodeCount <= NUMA_MAX_NODES);
+
+	*node = 0;
+	for (uint32_t i = 1; i < nodeCount; i++)
+	{
+		if (isSysfsPathExists("/sys/devices/system/cpu/cpu%u/node%u", cpu, i))
+		{
+			*node = i;
+			break;
+		}
+	}
+
+cleanup:
+	return err;
+}
+
+#endif
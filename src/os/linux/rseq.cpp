@@ -9,30 +9,20 @@
 #include <cstddef>
 #include <cstdlib>
 #include <dlfcn.h>
+#include <stdatomic.h>
 #include <linux/rseq.h>
+#include <sys/auxv.h>
 #include <syscall.h>
 #include <threads.h>
 
-#include <ucontext.h>
 #include <unistd.h>
-#include <setjmp.h>
-#define RSEQ_SIG 0
+#ifndef AT_RSEQ_FEATURE_SIZE
+#define AT_RSEQ_FEATURE_SIZE 27
+#endif
 
 /* Allocate a large area for the TLS. */
 #define RSEQ_THREAD_AREA_ALLOC_SIZE	1024
 
-typedef struct
-{
-	rseqCallback rseq;
-
-	bool shouldRetry;
-	size_t maxRetrys;
-	void *data;
-	err_t err;
-} rseqCall;
-
-thread_local jmp_buf rseqJumpBuffer;
-
 volatile thread_local struct rseq r  = {.cpu_id_start = 0,
 																			 .cpu_id = (__u32)RSEQ_CPU_ID_UNINITIALIZED,
 																			 .rseq_cs = 0,
@@ -42,9 +32,6 @@ volatile thread_local struct rseq r  = {.cpu_id_start = 0,
 
 };
 
-extern void *__start_rseq;
-extern void *__stop_rseq;
-
 THROWS static err_t sysRseq(volatile struct rseq *rseq_abi, uint32_t rseq_len, int flags, uint32_t sig)
 {
 	err_t err = NO_ERRORCODE;
@@ -55,135 +42,88 @@ cleanup:
 	return err;
 }
 
-static const ptrdiff_t *libc_rseq_offset_p;
-static const unsigned int *libc_rseq_size_p;
-static const unsigned int *libc_rseq_flags_p;
+bool isLibcRseqArea = false;
+ptrdiff_t libcRseqOffset = 0;
+static bool isLibcRseqChecked = false;
 
-THROWS err_t rseqInit()
+// the size of the area the kernel fills, ours or the one libc registered
+static uint32_t rseqAreaSize = sizeof(struct rseq);
+
+/**
+ * @brief look for the area of libc once for the process, glibc registers one for every thread or for none of them(the
+ * glibc.pthread.rseq tunable) so the first thread that gets here decides for all of them.
+ * @note __rseq_size is 0 if glibc has rseq but did not register, an older glibc doesn't have the symbols at all
+ */
+static void findLibcRseqArea()
 {
-	err_t err = NO_ERRORCODE;
+	const ptrdiff_t *offset = NULL;
+	const unsigned int *size = NULL;
 
-	libc_rseq_offset_p = (long *)dlsym(RTLD_NEXT, "__rseq_offset");
-	libc_rseq_size_p = (uint32_t *)dlsym(RTLD_NEXT, "__rseq_size");
-	libc_rseq_flags_p = (uint32_t *)dlsym(RTLD_NEXT, "__rseq_flags");
-	if (libc_rseq_size_p && libc_rseq_offset_p && libc_rseq_flags_p && *libc_rseq_size_p != 0)
+	if (atomic_load((_Atomic bool *)&isLibcRseqChecked))
 	{
+		return;
 	}
 
-	RETHROW(sysRseq(&r, sizeof(struct rseq), 0, RSEQ_SIG));
+	offset = (const ptrdiff_t *)dlsym(RTLD_NEXT, "__rseq_offset");
+	size = (const unsigned int *)dlsym(RTLD_NEXT, "__rseq_size");
+	if (offset != NULL && size != NULL && *size != 0)
+	{
+		libcRseqOffset = *offset;
+		rseqAreaSize = *size;
+		atomic_store((_Atomic bool *)&isLibcRseqArea, true);
+	}
 
-cleanup:
-	return err;
+	atomic_store((_Atomic bool *)&isLibcRseqChecked, true);
 }
 
-
-// we use optnone becose the compiler might reorder some stuff the can break stuff 
-USED_IN_RSEQ
-__attribute__((optnone))
-void handleRseq(const rseq_cs *cs, rseqCall *rseqData)
+THROWS err_t rseqInit()
 {
-
 	err_t err = NO_ERRORCODE;
 
-	// volatile uint32_t cpuId = r.cpu_id;
-
-	CHECK_NOTRACE_ERRORCODE(cs != NULL, EINVAL);
-	CHECK_NOTRACE_ERRORCODE(rseqData != NULL, EINVAL);
-
-	r.rseq_cs = (uint64_t)cs;
-	QUITE_CHECK(r.cpu_id_start == r.cpu_id);
-
-	// cpuId = r.cpu_id_start;
-
-	QUITE_RETHROW(rseqData->rseq(rseqData->data));
+	findLibcRseqArea();
+	if (isLibcRseqArea)
+	{
+		CHECK(getRseqArea()->cpu_id != (uint32_t)RSEQ_CPU_ID_UNINITIALIZED);
+		goto cleanup;
+	}
 
-	// CHECK_NOTRACE_ERRORCODE(r.rseq_cs != 0, 0);
-	// CHECK_NOTRACE_ERRORCODE(r.cpu_id_start == r.cpu_id, 0);
-	// CHECK_NOTRACE_ERRORCODE(r.cpu_id == cpuId, 0);
+	RETHROW(sysRseq(&r, sizeof(struct rseq), 0, RSEQ_SIG));
 
 cleanup:
-	r.rseq_cs = 0;
-	rseqData->shouldRetry = false;
-	rseqData->err = err;
+	return err;
 }
 
 
-THROWS err_t doRseq(size_t maxRetrys, rseqCallback rseqFunc, rseqAbortHandlerCallback abortHandler, void *data)
+THROWS err_t getCpuId(uint32_t *cpuId)
 {
 	err_t err = NO_ERRORCODE;
+	CHECK_NOTRACE_ERRORCODE(cpuId != NULL, EINVAL);
+	CHECK_NOTRACE_ERRORCODE(getRseqArea()->cpu_id != (uint32_t)RSEQ_CPU_ID_UNINITIALIZED, EINVAL);
+	CHECK_NOTRACE_ERRORCODE(getRseqArea()->cpu_id != (uint32_t)RSEQ_CPU_ID_REGISTRATION_FAILED, EINVAL);
 
-	volatile bool static alwaystrue = true;
-	rseqCall rseqData = {rseqFunc, true, maxRetrys, data, NO_ERRORCODE};
-
-	const rseq_cs cs = {0, 0, (uint64_t)&__start_rseq, (uint64_t)&__stop_rseq - (uint64_t)&__start_rseq,
-							   (uint64_t)&&restart};
-
-	unlikelyIf(r.cpu_id == (__u32)RSEQ_CPU_ID_UNINITIALIZED)
-	{
-		QUITE_RETHROW(rseqInit());
-	}
-
-	QUITE_CHECK(maxRetrys > 0);
-	QUITE_CHECK(rseqFunc != NULL);
-
-	QUITE_CHECK((uint64_t)rseqFunc >= (uint64_t)&__start_rseq && (uint64_t)rseqFunc <= (uint64_t)&__stop_rseq);
-	QUITE_CHECK(
-		!((uint64_t)abortHandler >= (uint64_t)&__start_rseq && (uint64_t)abortHandler <= (uint64_t)&__stop_rseq));
-
-	if (alwaystrue)  [[likely]]
-	{
-		goto start;
-	}
-	asm __volatile__(".int 0\n\t");
-
-restart:
-
-	// the abort handler will be called with invalid stack
-	// we want to go back to the main context instad of trying to work with invalid stack.
-	// remainder to get here the rseq context do "long jump" from within a function to outside of a function
-	// this mean we can't call return from here.
-	longjmp(rseqJumpBuffer, 0);
-
-	// if we get here we can't get back to the main context and we can't return so rip.
-	exit(errno);
-
-start:
-
-	// we want all the rseq function to be on there own section
-	// that allow as to call other functions that are in that section
-	// but that means the rseq abort handler need to be on other function
-	// that will mean we can't return from the abort handler(the return addr will be wrong)
-	// so we can use setjmp to save a valid stack outside of the rseq and go back to it.
-	while(!setjmp(rseqJumpBuffer) && rseqData.shouldRetry && rseqData.maxRetrys > 0)
-	{
-		rseqData.shouldRetry = true;
-		handleRseq(&cs, &rseqData);
-		QUITE_RETHROW(rseqData.err);
-		if (rseqData.shouldRetry)
-		{
-			rseqData.maxRetrys--;
-			if (abortHandler != NULL)
-			{
-				QUITE_RETHROW(abortHandler(&rseqData.shouldRetry, rseqData.data));
-			}
-		}
-	}
-
+	*cpuId = getRseqArea()->cpu_id_start;
 
-	QUITE_CHECK(rseqData.maxRetrys != 0);
 cleanup:
-
 	return err;
 }
 
-__attribute__((section("rseq"))) THROWS err_t getCpuId(uint32_t *cpuId)
+bool isRseqMmCidSupported()
+{
+	// the kernel tells how much of struct rseq it fills, before linux 6.3 there is no such aux value and we get 0. the
+	// area libc registered can also be to small for it
+	findLibcRseqArea();
+	return getauxval(AT_RSEQ_FEATURE_SIZE) >= offsetof(struct rseq, mm_cid) + sizeof(r.mm_cid) &&
+		   rseqAreaSize >= offsetof(struct rseq, mm_cid) + sizeof(r.mm_cid);
+}
+
+THROWS err_t getMmCid(uint32_t *mmCid)
 {
 	err_t err = NO_ERRORCODE;
-	CHECK_NOTRACE_ERRORCODE(cpuId != NULL, EINVAL);
-	CHECK_NOTRACE_ERRORCODE(r.cpu_id != (uint32_t)RSEQ_CPU_ID_UNINITIALIZED, EINVAL);
-	CHECK_NOTRACE_ERRORCODE(r.cpu_id != (uint32_t)RSEQ_CPU_ID_REGISTRATION_FAILED, EINVAL);
+	CHECK_NOTRACE_ERRORCODE(mmCid != NULL, EINVAL);
+	CHECK_NOTRACE_ERRORCODE(getRseqArea()->cpu_id != (uint32_t)RSEQ_CPU_ID_UNINITIALIZED, EINVAL);
+	CHECK_NOTRACE_ERRORCODE(getRseqArea()->cpu_id != (uint32_t)RSEQ_CPU_ID_REGISTRATION_FAILED, EINVAL);
 
-	*cpuId = r.cpu_id_start;
+	*mmCid = getRseqArea()->mm_cid;
 
 cleanup:
 	return err;
@@ -9,28 +9,222 @@
 
 #include <fcntl.h>
 #include <linux/memfd.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+
+// "SHMEMFIL", so a process that reads something else from the socket fails instead of mapping garbage
+#define SHARED_MEMORY_FILE_MAGIC 0x53484d454d46494cul
+
+/**
+ * @brief what a process needs to map the file the same way as the one that created it.
+ */
+typedef struct
+{
+	uint64_t magic;
+	size_t maxSize;
+	sharedMemoryPageMode pageMode;
+	size_t pageSize;
+} sharedMemoryFileInfo;
 
 size_t maxSize = 0;
 size_t *currentSize = nullptr;
 void *startAddr = nullptr;
 fd_t memfd = INVALID_FD;
+sharedMemoryPageMode pageMode = SHARED_MEMORY_FILE_DEFAULT_PAGE_MODE;
+size_t pageSize = 0;
+bool isPrivate = false;
+
+/**
+ * @brief a private file has no memfd, it is only the mapping.
+ */
+static bool isFileCreated()
+{
+	return isPrivate ? startAddr != nullptr : IS_VALID_FD(memfd);
+}
 
-THROWS err_t initHugeFs(size_t hugefsSize)
+THROWS err_t initHugeFs(size_t hugePageSizeKb, size_t pageCount)
 {
 	fd_t hugeNr = INVALID_FD;
 	err_t err = NO_ERRORCODE;
 	ssize_t bytesWritten = 0;
+	char count[32] = {0};
+	int countLength = 0;
+
 	QUITE_RETHROW(
-		safeOpenFmt("/sys/kernel/mm/hugepages/hugepages-%lukB/nr_hugepages", O_WRONLY, 0, &hugeNr, hugefsSize));
+		safeOpenFmt("/sys/kernel/mm/hugepages/hugepages-%lukB/nr_hugepages", O_WRONLY, 0, &hugeNr, hugePageSizeKb));
 
-	QUITE_RETHROW(safeWrite(hugeNr, "1000", sizeof("1000"), &bytesWritten));
+	countLength = snprintf(count, sizeof(count), "%lu", pageCount);
+	QUITE_CHECK(countLength > 0);
+	QUITE_RETHROW(safeWrite(hugeNr, count, countLength, &bytesWritten));
 
 cleanup:
 	safeClose(&hugeNr);
 	return err;
 }
 
+THROWS err_t setSharedMemoryFilePageMode(sharedMemoryPageMode mode)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(startAddr == nullptr);
+	QUITE_CHECK(mode >= SHARED_MEMORY_PAGES_DEFAULT && mode <= SHARED_MEMORY_PAGES_HUGE_1GB);
+
+	pageMode = mode;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t setSharedMemoryFilePrivate(bool _isPrivate)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(startAddr == nullptr);
+
+	isPrivate = _isPrivate;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t getSharedMemoryFilePageMode(sharedMemoryPageMode *mode, size_t *size)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(startAddr != nullptr);
+	QUITE_CHECK(mode != nullptr);
+	QUITE_CHECK(size != nullptr);
+
+	*mode = pageMode;
+	*size = pageSize;
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief the MAP_HUGETLB flags of a private mapping with the pages of pageMode.
+ */
+static int getHugeTlbFlags()
+{
+	return pageMode == SHARED_MEMORY_PAGES_HUGE_2MB	  ? MAP_HUGETLB | (21 << MAP_HUGE_SHIFT)
+		   : pageMode == SHARED_MEMORY_PAGES_HUGE_1GB ? MAP_HUGETLB | (30 << MAP_HUGE_SHIFT)
+													  : 0;
+}
+
+/**
+ * @brief create the memfd with the pages of pageMode, a hugetlb file that can't be created(no huge pages of that size
+ * in the kernel pool, or no hugetlbfs at all) falls back to transparent huge pages.
+ */
+THROWS static err_t createMemfd()
+{
+	err_t err = NO_ERRORCODE;
+	void *hugePage = MAP_FAILED;
+
+	if (isPrivate)
+	{
+		// there is no file to create, a huge page that can be mapped(and reserved) now tells the pool has pages of
+		// that size
+		if (getHugeTlbFlags() != 0)
+		{
+			pageSize = pageMode == SHARED_MEMORY_PAGES_HUGE_2MB ? 1ul << 21 : 1ul << 30;
+			hugePage = mmap(NULL, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | getHugeTlbFlags(),
+							-1, 0);
+			if (hugePage != MAP_FAILED)
+			{
+				munmap(hugePage, pageSize);
+				goto cleanup;
+			}
+
+			pageMode = SHARED_MEMORY_PAGES_TRANSPARENT_HUGE;
+		}
+
+		pageSize = sysconf(_SC_PAGESIZE);
+		goto cleanup;
+	}
+
+	if (pageMode == SHARED_MEMORY_PAGES_HUGE_2MB || pageMode == SHARED_MEMORY_PAGES_HUGE_1GB)
+	{
+		memfd.fd = memfd_create("shared memory pool",
+								MFD_HUGETLB | (pageMode == SHARED_MEMORY_PAGES_HUGE_2MB ? MFD_HUGE_2MB : MFD_HUGE_1GB));
+		if (IS_VALID_FD(memfd))
+		{
+			pageSize = pageMode == SHARED_MEMORY_PAGES_HUGE_2MB ? 1ul << 21 : 1ul << 30;
+
+			// the file is created even if the kernel pool has no huge pages, the first touch of a page would then
+			// SIGBUS, so we allocate one to see there is one
+			if (fallocate(memfd.fd, 0, 0, pageSize) == 0 && ftruncate(memfd.fd, 0) == 0)
+			{
+				goto cleanup;
+			}
+
+			safeClose(&memfd);
+		}
+
+		pageMode = SHARED_MEMORY_PAGES_TRANSPARENT_HUGE;
+	}
+
+	memfd.fd = memfd_create("shared memory pool", 0);
+	QUITE_CHECK(IS_VALID_FD(memfd));
+	pageSize = sysconf(_SC_PAGESIZE);
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief a shared hugetlb mapping reserves all of its huge pages up front unless it is MAP_NORESERVE, we only want the
+ * pages the file really uses.
+ */
+static int getMapFlags()
+{
+	if (isPrivate)
+	{
+		return MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | getHugeTlbFlags();
+	}
+
+	return MAP_SHARED_VALIDATE | (pageSize > (size_t)sysconf(_SC_PAGESIZE) ? MAP_NORESERVE : 0);
+}
+
+/**
+ * @brief map the memfd(or private memory) at a SHARED_MEMORY_FILE_ALIGNMENT aligned address.
+ * we reserve a bigger range, map the file over the aligned part of it and give back the rest.
+ */
+THROWS static err_t mapAligned(size_t size, void **addr)
+{
+	err_t err = NO_ERRORCODE;
+	uint8_t *reserved = (uint8_t *)MAP_FAILED;
+	uint8_t *aligned = nullptr;
+	size_t reservedSize = size + SHARED_MEMORY_FILE_ALIGNMENT;
+
+	reserved = (uint8_t *)mmap(NULL, reservedSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	QUITE_CHECK(reserved != MAP_FAILED);
+
+	aligned = (uint8_t *)(((size_t)reserved + SHARED_MEMORY_FILE_ALIGNMENT - 1) & ~(SHARED_MEMORY_FILE_ALIGNMENT - 1));
+
+	QUITE_CHECK(mmap(aligned, size, PROT_READ | PROT_WRITE, getMapFlags() | MAP_FIXED, memfd.fd, 0) == aligned);
+
+	if (aligned != reserved)
+	{
+		QUITE_CHECK(munmap(reserved, aligned - reserved) == 0);
+	}
+
+	QUITE_CHECK(munmap(aligned + size, reserved + reservedSize - (aligned + size)) == 0);
+
+	*addr = aligned;
+	reserved = (uint8_t *)MAP_FAILED;
+
+cleanup:
+	if (reserved != MAP_FAILED)
+	{
+		munmap(reserved, reservedSize);
+	}
+
+	return err;
+}
+
 THROWS err_t initSharedMemoryFile(size_t _maxSize)
 {
 	err_t err = NO_ERRORCODE;
@@ -39,17 +233,20 @@ THROWS err_t initSharedMemoryFile(size_t _maxSize)
 	QUITE_CHECK(startAddr == nullptr);
 	QUITE_CHECK(IS_INVALID_FD(memfd));
 
-	// QUITE_RETHROW(initHugeFs(2048));
-
-	memfd.fd = memfd_create("shared memory pool", 0 /* MFD_HUGETLB | MFD_HUGE_2MB */);
-	QUITE_CHECK(IS_VALID_FD(memfd));
+	QUITE_RETHROW(createMemfd());
+	QUITE_CHECK(SHARED_MEMORY_FILE_ALIGNMENT % pageSize == 0);
+	QUITE_CHECK(_maxSize % pageSize == 0);
 
 	currentSize = new size_t(0);
 
 	maxSize = _maxSize;
-	startAddr = mmap(NULL, maxSize, PROT_READ | PROT_WRITE, MAP_SHARED_VALIDATE /* | MAP_HUGETLB | MAP_NORESERVE */,
-					 memfd.fd, 0);
-	QUITE_CHECK(startAddr != MAP_FAILED);
+	QUITE_RETHROW(mapAligned(maxSize, &startAddr));
+
+	if (pageMode == SHARED_MEMORY_PAGES_TRANSPARENT_HUGE)
+	{
+		// only a hint, a kernel without shmem thp just keeps using regular pages
+		madvise(startAddr, maxSize, MADV_HUGEPAGE);
+	}
 
 cleanup:
 	return err;
@@ -61,12 +258,16 @@ err_t closeSharedMemoryFile()
 
 	QUITE_CHECK(maxSize > 0);
 	QUITE_CHECK(startAddr != nullptr);
-	QUITE_CHECK(IS_VALID_FD(memfd));
+	QUITE_CHECK(isFileCreated());
 
 	QUITE_CHECK(munmap(startAddr, maxSize) == 0);
 	startAddr = nullptr;
 
-	QUITE_RETHROW(safeClose(&memfd));
+	if (!isPrivate)
+	{
+		QUITE_RETHROW(safeClose(&memfd));
+	}
+	currentSize = nullptr;
 cleanup:
 	return err;
 }
@@ -76,12 +277,14 @@ THROWS err_t setSharedMemoryFileSize(size_t size)
 	err_t err = NO_ERRORCODE;
 
 	QUITE_CHECK(currentSize != nullptr);
-	QUITE_CHECK(IS_VALID_FD(memfd));
+	QUITE_CHECK(isFileCreated());
 
-	// size is not huge pages allinged
-//	QUITE_CHECK((size % (1 << 21)) == 0);
+	// a hugetlb file can only be a whole number of huge pages, so the file grows by whole pages
+	size = (size + pageSize - 1) & ~(pageSize - 1);
+	QUITE_CHECK(size <= maxSize);
 
-	QUITE_CHECK(ftruncate(memfd.fd, size) == 0);
+	// private memory is all there from the start, the size is only what the pool uses
+	QUITE_CHECK(isPrivate || ftruncate(memfd.fd, size) == 0);
 	*currentSize = size;
 
 cleanup:
@@ -92,7 +295,7 @@ THROWS err_t getSharedMemoryFileSize(size_t *size)
 {
 	err_t err = NO_ERRORCODE;
 
-	QUITE_CHECK(IS_VALID_FD(memfd));
+	QUITE_CHECK(isFileCreated());
 	QUITE_CHECK(currentSize != nullptr);
 
 	QUITE_CHECK(size != nullptr);
@@ -120,7 +323,7 @@ THROWS err_t getSharedMemoryFileStartAddr(void **ptr)
 	err_t err = NO_ERRORCODE;
 
 	QUITE_CHECK(startAddr != nullptr);
-	QUITE_CHECK(IS_VALID_FD(memfd));
+	QUITE_CHECK(isFileCreated());
 
 	QUITE_CHECK(ptr != nullptr);
 
@@ -129,4 +332,189 @@ cleanup:
 	return err;
 }
 
+THROWS err_t releaseSharedMemoryFileRange(void *addr, size_t size)
+{
+	err_t err = NO_ERRORCODE;
+	size_t offset = 0;
+	size_t end = 0;
+
+	QUITE_CHECK(startAddr != nullptr);
+	QUITE_CHECK(isFileCreated());
+	QUITE_CHECK((uint8_t *)addr >= (uint8_t *)startAddr && (uint8_t *)addr + size <= (uint8_t *)startAddr + maxSize);
+
+	// hugetlbfs can only punch whole huge pages, so only the ones fully in the range are released
+	offset = (((uint8_t *)addr - (uint8_t *)startAddr) + pageSize - 1) & ~(pageSize - 1);
+	end = ((uint8_t *)addr + size - (uint8_t *)startAddr) & ~(pageSize - 1);
+	if (end > offset && isPrivate)
+	{
+		QUITE_CHECK(madvise((uint8_t *)startAddr + offset, end - offset, MADV_DONTNEED) == 0);
+	}
+	else if (end > offset)
+	{
+		QUITE_CHECK(fallocate(memfd.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, end - offset) == 0);
+	}
+
+cleanup:
+	return err;
+}
+
+THROWS err_t setSharedMemoryFileSizeLocation(size_t *location, bool copyCurrentSize)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(currentSize != nullptr);
+	QUITE_CHECK(location != nullptr);
+
+	if (copyCurrentSize)
+	{
+		*location = *currentSize;
+	}
+
+	// the first size is allocated in initSharedMemoryFile, one attached with attachSharedMemoryFile is already in the
+	// file
+	if (currentSize != location)
+	{
+		delete currentSize;
+	}
+
+	currentSize = location;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t sendSharedMemoryFile(int socketFd)
+{
+	err_t err = NO_ERRORCODE;
+	sharedMemoryFileInfo info = {SHARED_MEMORY_FILE_MAGIC, maxSize, pageMode, pageSize};
+	struct iovec iov = {&info, sizeof(info)};
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {0};
+	struct msghdr msg = {};
+	struct cmsghdr *cmsg = NULL;
+
+	QUITE_CHECK(startAddr != nullptr);
+	QUITE_CHECK(IS_VALID_FD(memfd));
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &memfd.fd, sizeof(int));
+
+	QUITE_CHECK(sendmsg(socketFd, &msg, MSG_NOSIGNAL) == sizeof(info));
+
+cleanup:
+	return err;
+}
+
+/**
+ * @brief receive the info and the fd of the file, the fd is closed if anything else in the message is wrong.
+ */
+THROWS static err_t receiveSharedMemoryFile(int socketFd, sharedMemoryFileInfo *info, fd_t *fd)
+{
+	err_t err = NO_ERRORCODE;
+	struct iovec iov = {info, sizeof(*info)};
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {0};
+	struct msghdr msg = {};
+	struct cmsghdr *cmsg = NULL;
+	ssize_t received = 0;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	received = recvmsg(socketFd, &msg, MSG_CMSG_CLOEXEC);
+	QUITE_CHECK(received >= 0);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+		cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+	{
+		memcpy(&fd->fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	QUITE_CHECK(IS_VALID_FD(*fd));
+	QUITE_CHECK((size_t)received == sizeof(*info) && (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0);
+	QUITE_CHECK(info->magic == SHARED_MEMORY_FILE_MAGIC);
+
+cleanup:
+	if (err.errorCode != 0)
+	{
+		safeClose(fd);
+	}
+
+	return err;
+}
+
+THROWS err_t attachSharedMemoryFile(int socketFd)
+{
+	err_t err = NO_ERRORCODE;
+	sharedMemoryFileInfo info = {};
+
+	QUITE_CHECK(startAddr == nullptr);
+	QUITE_CHECK(IS_INVALID_FD(memfd));
+	QUITE_CHECK(!isPrivate);
+
+	QUITE_RETHROW(receiveSharedMemoryFile(socketFd, &info, &memfd));
+
+	maxSize = info.maxSize;
+	pageMode = info.pageMode;
+	pageSize = info.pageSize;
+
+	// the pool only keeps offsets, so any address works as long as it has the same alignment as in the sender
+	QUITE_RETHROW(mapAligned(maxSize, &startAddr));
+
+	if (pageMode == SHARED_MEMORY_PAGES_TRANSPARENT_HUGE)
+	{
+		madvise(startAddr, maxSize, MADV_HUGEPAGE);
+	}
+
+	// setSharedMemoryFileSizeLocation points it at the size in the file
+	currentSize = new size_t(0);
+
+cleanup:
+	if (err.errorCode != 0)
+	{
+		safeClose(&memfd);
+		maxSize = 0;
+	}
+
+	return err;
+}
+
+THROWS err_t getSharedMemoryHandle(const void *ptr, sharedMemoryHandle *handle)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(startAddr != nullptr);
+	QUITE_CHECK(handle != nullptr);
+	QUITE_CHECK(ptr == nullptr ||
+				((uint8_t *)ptr > (uint8_t *)startAddr && (uint8_t *)ptr < (uint8_t *)startAddr + maxSize));
+
+	*handle = ptr == nullptr ? SHARED_MEMORY_NULL_HANDLE : (uint8_t *)ptr - (uint8_t *)startAddr;
+
+cleanup:
+	return err;
+}
+
+THROWS err_t getSharedMemoryPointer(sharedMemoryHandle handle, void **ptr)
+{
+	err_t err = NO_ERRORCODE;
+
+	QUITE_CHECK(startAddr != nullptr);
+	QUITE_CHECK(ptr != nullptr);
+	QUITE_CHECK(handle < maxSize);
+
+	*ptr = handle == SHARED_MEMORY_NULL_HANDLE ? nullptr : (uint8_t *)startAddr + handle;
+
+cleanup:
+	return err;
+}
+
 #endif